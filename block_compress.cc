@@ -0,0 +1,170 @@
+#include "block_compress.h"
+
+#include <algorithm>
+#include <cmath>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+uint16_t to565(const float c[3])
+{
+    auto q = [](float v, int maxv) {
+        return uint16_t(std::min(float(maxv), std::max(0.0f, v * maxv / 255.0f + 0.5f)));
+    };
+    return uint16_t((q(c[0], 31) << 11) | (q(c[1], 63) << 5) | q(c[2], 31));
+}
+
+void from565(uint16_t c, int out[3])
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+//------------------------------------------------------------------------------
+
+void encodeBC1Block(const uint8_t block[16][3], uint8_t out[8])
+{
+    // mean and covariance of the block's colors
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) mean[c] += block[i][c];
+    }
+    for (int c = 0; c < 3; ++c) mean[c] /= 16.0f;
+
+    float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i) {
+        float r = block[i][0] - mean[0];
+        float g = block[i][1] - mean[1];
+        float b = block[i][2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iter = 0; iter < 4; ++iter) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float len = std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+        if (len < 1e-6f)
+            break;
+        axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+    }
+
+    // extremes along the axis become the endpoints
+    float lo = 1e30f, hi = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = (block[i][0] - mean[0]) * axis[0] +
+                  (block[i][1] - mean[1]) * axis[1] +
+                  (block[i][2] - mean[2]) * axis[2];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    float norm2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    if (norm2 < 1e-12f) norm2 = 1.0f;
+    float cmax[3], cmin[3];
+    for (int c = 0; c < 3; ++c) {
+        cmax[c] = mean[c] + axis[c] * hi / norm2;
+        cmin[c] = mean[c] + axis[c] * lo / norm2;
+    }
+
+    uint16_t c0 = to565(cmax);
+    uint16_t c1 = to565(cmin);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        // four color mode: c0 > c1
+        int p[4][3];
+        from565(c0, p[0]);
+        from565(c1, p[1]);
+        for (int c = 0; c < 3; ++c) {
+            p[2][c] = (2 * p[0][c] + p[1][c]) / 3;
+            p[3][c] = (p[0][c] + 2 * p[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDist = 1 << 30;
+            for (int k = 0; k < 4; ++k) {
+                int dr = block[i][0] - p[k][0];
+                int dg = block[i][1] - p[k][1];
+                int db = block[i][2] - p[k][2];
+                int d = dr * dr + dg * dg + db * db;
+                if (d < bestDist) {
+                    bestDist = d;
+                    best = k;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    out[0] = uint8_t(c0 & 0xff);
+    out[1] = uint8_t(c0 >> 8);
+    out[2] = uint8_t(c1 & 0xff);
+    out[3] = uint8_t(c1 >> 8);
+    out[4] = uint8_t(indices & 0xff);
+    out[5] = uint8_t((indices >> 8) & 0xff);
+    out[6] = uint8_t((indices >> 16) & 0xff);
+    out[7] = uint8_t(indices >> 24);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+size_t CompressedTexture::byteSize() const
+{
+    size_t size = 0;
+    for (const auto &level : levels) {
+        size += level.size();
+    }
+    return size;
+}
+
+//------------------------------------------------------------------------------
+
+size_t compressedSize(uint32_t width, uint32_t height, BlockFormat format)
+{
+    (void)format; // BC1 is the only format
+    size_t bw = (width + 3) / 4;
+    size_t bh = (height + 3) / 4;
+    return bw * bh * 8;
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<uint8_t> compressBlocks(const uint8_t *pixels,
+                                    uint32_t width, uint32_t height,
+                                    size_t stride, int channels,
+                                    BlockFormat format)
+{
+    std::vector<uint8_t> out(compressedSize(width, height, format));
+    if (!pixels || width == 0 || height == 0)
+        return out;
+
+    uint8_t *dst = out.data();
+    uint8_t block[16][3];
+    for (uint32_t by = 0; by < height; by += 4) {
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            for (uint32_t y = 0; y < 4; ++y) {
+                const uint8_t *row = pixels + std::min(by + y, height - 1) * stride;
+                for (uint32_t x = 0; x < 4; ++x) {
+                    const uint8_t *p = row + size_t(std::min(bx + x, width - 1)) * channels;
+                    block[y * 4 + x][0] = p[0];
+                    block[y * 4 + x][1] = p[1];
+                    block[y * 4 + x][2] = p[2];
+                }
+            }
+            encodeBC1Block(block, dst);
+            dst += 8;
+        }
+    }
+    return out;
+}
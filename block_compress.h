@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// Block compression of texture images for upload as S3TC/BC1 (DXT1). Each 4x4
+// block of RGB pixels becomes 8 bytes: two RGB565 endpoints and 2-bit indices
+// into the four colors interpolated between them. Alpha is dropped.
+//
+// The encoder fits the endpoints along the principal axis of each block's
+// colors. It is not as good as an exhaustive encoder but it is fast enough to
+// run while loading, and its results are cached on disk.
+
+// Bumped whenever the encoder output changes, to invalidate cached results.
+// That includes the mip chains it encodes (2: odd sides keep their edge).
+const uint32_t kBlockEncoderVersion = 2;
+
+enum class BlockFormat : uint32_t {
+    BC1 = 1,
+};
+
+// A compressed image with its full mip chain, level 0 first.
+struct CompressedTexture {
+    BlockFormat format = BlockFormat::BC1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<std::vector<uint8_t>> levels;
+
+    size_t byteSize() const;
+};
+
+// Size in bytes of a width x height image in format.
+size_t compressedSize(uint32_t width, uint32_t height, BlockFormat format);
+
+// Compresses an image with 3 or 4 channels of 8 bits whose rows are stride
+// bytes apart. Partial blocks at the right and bottom edges repeat the last
+// column and row.
+std::vector<uint8_t> compressBlocks(const uint8_t *pixels,
+                                    uint32_t width, uint32_t height,
+                                    size_t stride, int channels,
+                                    BlockFormat format = BlockFormat::BC1);
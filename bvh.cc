@@ -0,0 +1,192 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+//------------------------------------------------------------------------------
+
+CullFrustum::CullFrustum(const filament::math::mat4f &clip_from_space)
+{
+    using namespace filament::math;
+
+    // matrices are column major, m[column][row]
+    const mat4f &m = clip_from_space;
+    float4 rows[4];
+    for (int r = 0; r < 4; ++r) {
+        rows[r] = float4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
+
+    const float4 candidates[6] = {
+        rows[3] + rows[0], rows[3] - rows[0],  // left, right
+        rows[3] + rows[1], rows[3] - rows[1],  // bottom, top
+        rows[3] + rows[2], rows[3] - rows[2],  // near, far
+    };
+    for (const float4 &plane : candidates) {
+        float len = length(plane.xyz);
+        if (len > 1e-6f)
+            planes[numPlanes++] = plane / len;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool CullFrustum::intersects(const filament::Box &box) const
+{
+    using namespace filament::math;
+
+    for (size_t p = 0; p < numPlanes; ++p) {
+        const float4 &plane = planes[p];
+        if (dot(plane.xyz, box.center) + plane.w + dot(abs(plane.xyz), box.halfExtent) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void Bvh::clear()
+{
+    mNodes.clear();
+    mItems.clear();
+    mBoxes.clear();
+    mAlways.clear();
+    mSize = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void Bvh::build(const std::vector<filament::Box> &boxes)
+{
+    using namespace filament::math;
+
+    clear();
+    mSize = boxes.size();
+
+    std::vector<float3> centroids(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        if (boxes[i].isEmpty()) {
+            mAlways.push_back(uint32_t(i));
+        } else {
+            mItems.push_back(uint32_t(i));
+            centroids[i] = boxes[i].center;
+        }
+    }
+    if (mItems.empty())
+        return;
+
+    mNodes.reserve(2 * (mItems.size() / kLeafSize) + 1);
+    mNodes.emplace_back();
+    buildNode(boxes, centroids, 0, 0, uint32_t(mItems.size()));
+
+    mBoxes.reserve(mItems.size());
+    for (uint32_t item : mItems) {
+        mBoxes.push_back(boxes[item]);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void Bvh::buildNode(const std::vector<filament::Box> &boxes,
+                    const std::vector<filament::math::float3> &centroids,
+                    uint32_t index, uint32_t begin, uint32_t end)
+{
+    using namespace filament::math;
+
+    float3 lo = boxes[mItems[begin]].getMin();
+    float3 hi = boxes[mItems[begin]].getMax();
+    float3 centroid_lo = centroids[mItems[begin]];
+    float3 centroid_hi = centroid_lo;
+    for (uint32_t i = begin + 1; i < end; ++i) {
+        const filament::Box &box = boxes[mItems[i]];
+        lo = min(lo, box.getMin());
+        hi = max(hi, box.getMax());
+        centroid_lo = min(centroid_lo, centroids[mItems[i]]);
+        centroid_hi = max(centroid_hi, centroids[mItems[i]]);
+    }
+
+    Node &node = mNodes[index];
+    node.center = (lo + hi) * 0.5f;
+    node.halfExtent = (hi - lo) * 0.5f;
+    node.first = begin;
+    node.count = end - begin;
+
+    const float3 spread = centroid_hi - centroid_lo;
+    if (end - begin <= kLeafSize || (spread.x <= 0.0f && spread.y <= 0.0f && spread.z <= 0.0f))
+        return;
+
+    // split at the median centroid along the axis they spread the most on.
+    int axis = spread.x > spread.y ? 0 : 1;
+    if (spread.z > spread[axis])
+        axis = 2;
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(mItems.begin() + begin, mItems.begin() + mid, mItems.begin() + end,
+                     [&](uint32_t a, uint32_t b) {
+                         return centroids[a][axis] < centroids[b][axis];
+                     });
+
+    const uint32_t left = uint32_t(mNodes.size());
+    node.left = left; // node is invalidated by the resize below
+    mNodes.resize(left + 2);
+    buildNode(boxes, centroids, left, begin, mid);
+    buildNode(boxes, centroids, left + 1, mid, end);
+}
+
+//------------------------------------------------------------------------------
+
+Bvh::Stats Bvh::cull(const CullFrustum &frustum, std::vector<uint8_t> &visible) const
+{
+    using namespace filament::math;
+
+    // 1 inside, 0 intersecting, -1 outside.
+    auto classify = [&](const float3 &center, const float3 &half_extent) {
+        int result = 1;
+        for (size_t p = 0; p < frustum.numPlanes; ++p) {
+            const float4 &plane = frustum.planes[p];
+            float d = dot(plane.xyz, center) + plane.w;
+            float r = dot(abs(plane.xyz), half_extent);
+            if (d + r < 0.0f)
+                return -1;
+            if (d - r < 0.0f)
+                result = 0;
+        }
+        return result;
+    };
+
+    Stats stats;
+    visible.assign(mSize, 0);
+    for (uint32_t item : mAlways) {
+        visible[item] = 1;
+        ++stats.visible;
+    }
+    if (mNodes.empty())
+        return stats;
+
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        const Node &node = mNodes[stack.back()];
+        stack.pop_back();
+        ++stats.nodesTested;
+
+        const int result = classify(node.center, node.halfExtent);
+        if (result < 0) {
+            stats.culled += node.count;
+        } else if (result > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                visible[mItems[i]] = 1;
+            }
+            stats.visible += node.count;
+        } else if (node.left == 0) {
+            // a leaf straddling the frustum, test its items one by one.
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const filament::Box &box = mBoxes[i];
+                const bool inside = classify(box.center, box.halfExtent) >= 0;
+                visible[mItems[i]] = inside ? 1 : 0;
+                ++(inside ? stats.visible : stats.culled);
+            }
+        } else {
+            stack.push_back(node.left + 1);
+            stack.push_back(node.left);
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <filament/Box.h>
+#include <math/mat4.h>
+#include <math/vec4.h>
+
+//------------------------------------------------------------------------------
+
+// Planes of a view frustum with their normals pointing inward, extracted from
+// a clip-from-space matrix (Gribb and Hartmann). A plane that degenerates,
+// like the far plane of an infinite projection, is left out.
+struct CullFrustum {
+    filament::math::float4 planes[6];
+    size_t numPlanes = 0;
+
+    explicit CullFrustum(const filament::math::mat4f &clip_from_space);
+
+    // False if box is entirely outside one of the planes.
+    bool intersects(const filament::Box &box) const;
+};
+
+//------------------------------------------------------------------------------
+
+// Bounding volume hierarchy over a set of axis aligned boxes, used to reject
+// whole groups of renderables against the view frustum with a single test.
+// Subtrees entirely outside the frustum are culled without visiting their
+// items, subtrees entirely inside are accepted without further tests.
+class Bvh {
+public:
+    struct Stats {
+        uint32_t visible = 0;
+        uint32_t culled = 0;
+        uint32_t nodesTested = 0;
+    };
+
+    // Items per leaf the build aims for.
+    static const uint32_t kLeafSize = 4;
+
+    // Builds the hierarchy over boxes; item i is boxes[i]. Empty boxes are
+    // never culled.
+    void build(const std::vector<filament::Box> &boxes);
+
+    void clear();
+
+    bool empty() const { return mNodes.empty(); }
+    size_t size() const { return mSize; }
+
+    // Resizes visible to size() and sets visible[i] to 1 for the items that
+    // may intersect the frustum and to 0 for the others.
+    Stats cull(const CullFrustum &frustum, std::vector<uint8_t> &visible) const;
+
+private:
+    // The items below a node are a contiguous range of mItems, so a subtree
+    // is culled without walking it.
+    struct Node {
+        filament::math::float3 center;
+        filament::math::float3 halfExtent;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t left = 0; // children are left and left + 1, 0 for leaves
+    };
+
+    void buildNode(const std::vector<filament::Box> &boxes,
+                   const std::vector<filament::math::float3> &centroids,
+                   uint32_t index, uint32_t begin, uint32_t end);
+
+    std::vector<Node> mNodes;
+    std::vector<uint32_t> mItems;     // leaves index into this
+    std::vector<filament::Box> mBoxes; // of mItems, in the same order
+    std::vector<uint32_t> mAlways;     // items with empty boxes
+    size_t mSize = 0;
+};
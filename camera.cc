@@ -17,6 +17,7 @@ void CameraManipulator::roll(float radians) {
     math::mat3f rotation = math::mat3f::rotation(radians, viewdir);
 
     m_up = normalize(rotation * m_up);
+    m_dirty = true;
 }
 
 //------------------------------------------------------------------------------
@@ -33,6 +34,7 @@ void CameraManipulator::yaw(float radians) {
     viewdir = normalize(rotation * viewdir);
 
     m_position = m_target - (viewdir * dist);
+    m_dirty = true;
 }
 
 //------------------------------------------------------------------------------
@@ -54,6 +56,7 @@ void CameraManipulator::pitch(float radians) {
     m_up = normalize(xform * m_up);
 
     m_position = m_target - (viewdir * dist);
+    m_dirty = true;
 }
 
 //------------------------------------------------------------------------------
@@ -68,6 +71,7 @@ void CameraManipulator::moveRelative(filament::math::float3 dir) {
     m_target += dir[0] * bivector;
     m_target += dir[1] * m_up;
     m_target += dir[2] * viewdir;
+    m_dirty = true;
 }
 
 //------------------------------------------------------------------------------
@@ -35,8 +35,14 @@ class CameraManipulator {
 
     void updateCamera(filament::Camera* cam);
 
+    // True once the camera moved, until clearDirty(). A new manipulator
+    // starts out dirty.
+    bool isDirty() const { return m_dirty; }
+    void clearDirty() { m_dirty = false; }
+
    private:
     filament::math::float3 m_position;
     filament::math::float3 m_target;
     filament::math::float3 m_up;
+    bool m_dirty = true;
 };
@@ -0,0 +1,108 @@
+#include "compressed_cache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtDebug>
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+
+static const quint32 kCompressedCacheMagic = 0x43425451; // "QTBC"
+
+//------------------------------------------------------------------------------
+
+QString defaultCompressedCacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/textures";
+}
+
+//------------------------------------------------------------------------------
+
+QByteArray hashFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&file))
+        return QByteArray();
+    return hash.result().toHex();
+}
+
+//------------------------------------------------------------------------------
+
+QString compressedCachePath(const QString &dir, const QByteArray &source_hash,
+                            BlockFormat format, int color_space)
+{
+    return QString("%1/%2_%3_%4_v%5.bct")
+        .arg(dir)
+        .arg(QString::fromLatin1(source_hash))
+        .arg(uint32_t(format))
+        .arg(color_space)
+        .arg(kBlockEncoderVersion);
+}
+
+//------------------------------------------------------------------------------
+
+bool loadCompressedTexture(const QString &path, CompressedTexture &out)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version, format, width, height, levels;
+    in >> magic >> version >> format >> width >> height >> levels;
+    if (in.status() != QDataStream::Ok || magic != kCompressedCacheMagic ||
+        version != kBlockEncoderVersion || format != uint32_t(BlockFormat::BC1) ||
+        levels == 0 || levels > 32) {
+        qInfo() << "Ignoring invalid compressed texture: " << path;
+        return false;
+    }
+
+    CompressedTexture tex;
+    tex.format = BlockFormat(format);
+    tex.width = width;
+    tex.height = height;
+    tex.levels.resize(levels);
+    for (quint32 i = 0; i < levels; ++i) {
+        uint32_t w = std::max(1u, width >> i);
+        uint32_t h = std::max(1u, height >> i);
+        size_t size = compressedSize(w, h, tex.format);
+        tex.levels[i].resize(size);
+        if (in.readRawData(reinterpret_cast<char*>(tex.levels[i].data()), int(size)) != int(size)) {
+            qInfo() << "Truncated compressed texture: " << path;
+            return false;
+        }
+    }
+
+    out = std::move(tex);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool saveCompressedTexture(const QString &path, const CompressedTexture &tex)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out << kCompressedCacheMagic << quint32(kBlockEncoderVersion) << quint32(tex.format)
+        << quint32(tex.width) << quint32(tex.height) << quint32(tex.levels.size());
+    for (const auto &level : tex.levels) {
+        out.writeRawData(reinterpret_cast<const char*>(level.data()), int(level.size()));
+    }
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
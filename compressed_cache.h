@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include "block_compress.h"
+
+//------------------------------------------------------------------------------
+
+// On-disk cache of block compressed textures. Entries are named after a hash
+// of the source file's contents, the block format, the color space the mip
+// chain was filtered in and the encoder version, so a changed file or encoder
+// never hits a stale entry.
+
+// Default cache directory under the platform's cache location.
+QString defaultCompressedCacheDir();
+
+// Hash of the file's contents, empty if it cannot be read.
+QByteArray hashFile(const QString &path);
+
+QString compressedCachePath(const QString &dir, const QByteArray &source_hash,
+                            BlockFormat format, int color_space);
+
+bool loadCompressedTexture(const QString &path, CompressedTexture &out);
+
+// Writes atomically, so concurrent loaders never see a partial file.
+bool saveCompressedTexture(const QString &path, const CompressedTexture &tex);
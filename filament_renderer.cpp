@@ -1,5 +1,7 @@
 #include "filament_renderer.h"
 #include "camera.h"
+#include "compressed_cache.h"
+#include "scene_cache.h"
 
 #include <filament/Fence.h>
 #include <filament/Camera.h>
@@ -8,6 +10,7 @@
 #include <filament/TextureSampler.h>
 #include <filament/IndirectLight.h>
 #include <filament/RenderTarget.h>
+#include <filament/SwapChain.h>
 #include <math/mat3.h>
 
 
@@ -22,31 +25,259 @@
 #include <mutex>
 #include "resources/resources.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <map>
 #include <fstream>
 #include <iostream>
 #include <chrono>
 #include <thread>
 
+//------------------------------------------------------------------------------
+
+// Hands ownership of a staging vector to the engine. The vector is freed by the
+// backend once the upload has completed.
+template <typename T>
+static filament::VertexBuffer::BufferDescriptor makeBufferDescriptor(std::vector<T> &&data)
+{
+    auto *owned = new std::vector<T>(std::move(data));
+    return filament::VertexBuffer::BufferDescriptor(owned->data(), owned->size() * sizeof(T),
+                                                    [](void *, size_t, void *user) {
+                                                        delete static_cast<std::vector<T>*>(user);
+                                                    }, owned);
+}
+
+// Points the engine at a stream of a memory mapped scene cache. The mapping is
+// kept alive until the upload has completed.
+static filament::VertexBuffer::BufferDescriptor
+makeMappedDescriptor(const std::shared_ptr<const void> &file, const void *data, size_t size)
+{
+    auto *owned = new std::shared_ptr<const void>(file);
+    return filament::VertexBuffer::BufferDescriptor(data, size,
+                                                    [](void *, size_t, void *user) {
+                                                        delete static_cast<std::shared_ptr<const void>*>(user);
+                                                    }, owned);
+}
+
+// Hands one staging stream of mesh to the engine: moved out of the mesh, or
+// pointing into the scene cache if the mesh was read from there.
+template <typename T>
+static filament::VertexBuffer::BufferDescriptor
+takeStream(MeshData &mesh, std::vector<T> &stream, const T *mapped, size_t count)
+{
+    if (mesh.isMapped())
+        return makeMappedDescriptor(mesh.mapped.file, mapped, count * sizeof(T));
+    return makeBufferDescriptor(std::move(stream));
+}
+
+// Wraps a decoded image for upload without copying it. QImage scanlines are
+// 32-bit aligned, which the descriptor has to know about for RGB images.
+static filament::Texture::PixelBufferDescriptor makePixelBuffer(const QImage &img)
+{
+    using namespace filament;
+
+    Texture::Format pixel_buffer_format = Texture::Format::RGB;
+    if (img.format() == QImage::Format_RGB888) {
+        pixel_buffer_format = Texture::Format::RGB;
+    } else if (img.format() == QImage::Format_RGBA8888) {
+        pixel_buffer_format = Texture::Format::RGBA;
+    } else {
+        qCritical() << "Invalid image format: " << img.format();
+    }
+
+    auto *owned = new QImage(img);
+    return Texture::PixelBufferDescriptor(owned->constBits(), size_t(owned->sizeInBytes()),
+                                          pixel_buffer_format,
+                                          Texture::Type::UBYTE,
+                                          4, 0, 0, 0,
+                                          [](void*, size_t, void* user) {
+                                              delete static_cast<QImage*>(user);
+                                          }, owned);
+}
+
+// Wraps one generated mip level; the chain is kept alive until the upload is
+// done. Levels are tightly packed.
+static filament::Texture::PixelBufferDescriptor
+makeMipBuffer(const std::shared_ptr<const std::vector<MipLevel>> &mips, size_t level,
+              filament::Texture::Format format)
+{
+    using namespace filament;
+
+    const MipLevel &mip = (*mips)[level];
+    auto *owned = new std::shared_ptr<const std::vector<MipLevel>>(mips);
+    return Texture::PixelBufferDescriptor(mip.pixels.data(), mip.pixels.size(),
+                                          format,
+                                          Texture::Type::UBYTE,
+                                          1, 0, 0, 0,
+                                          [](void*, size_t, void* user) {
+                                              delete static_cast<std::shared_ptr<const std::vector<MipLevel>>*>(user);
+                                          }, owned);
+}
+
+// Uploads the full image and every level of its mip chain.
+static void setTextureImages(filament::Engine &engine, filament::Texture *tex,
+                             const QImage &img,
+                             const std::shared_ptr<const std::vector<MipLevel>> &mips)
+{
+    using namespace filament;
+
+    Texture::Format format = img.format() == QImage::Format_RGBA8888
+        ? Texture::Format::RGBA : Texture::Format::RGB;
+    tex->setImage(engine, 0, makePixelBuffer(img));
+    for (size_t level = 0; mips && level < mips->size(); ++level) {
+        tex->setImage(engine, uint8_t(level + 1), makeMipBuffer(mips, level, format));
+    }
+}
+
+// Wraps one level of a block compressed chain; the chain is kept alive until
+// the upload is done.
+static filament::Texture::PixelBufferDescriptor
+makeCompressedBuffer(const std::shared_ptr<const CompressedTexture> &tex, size_t level,
+                     filament::Texture::CompressedType type)
+{
+    using namespace filament;
+
+    const std::vector<uint8_t> &data = tex->levels[level];
+    auto *owned = new std::shared_ptr<const CompressedTexture>(tex);
+    return Texture::PixelBufferDescriptor(data.data(), data.size(),
+                                          type, uint32_t(data.size()),
+                                          [](void*, size_t, void* user) {
+                                              delete static_cast<std::shared_ptr<const CompressedTexture>*>(user);
+                                          }, owned);
+}
+
+// Sampler used for all material textures, trilinear across the mip chain.
+static filament::TextureSampler materialSampler()
+{
+    using namespace filament;
+    return TextureSampler(TextureSampler::MinFilter::LINEAR_MIPMAP_LINEAR,
+                          TextureSampler::MagFilter::LINEAR,
+                          TextureSampler::WrapMode::REPEAT);  // repeat is needed
+}
+
+// Largest edge of the low resolution stand-in shown while a texture streams in.
+static const int kPlaceholderSize = 16;
+
+// A coarser LOD is only picked once its error is this far under the
+// threshold, so meshes near a switching distance do not flicker.
+static const float kLodHysteresis = 0.7f;
+
+// Occluders are the coarsest LOD of a mesh, if it has at most this many
+// triangles. Each frame the largest ones on screen are rasterized until the
+// triangle budget or the occluder count is reached.
+static const size_t kMaxOccluderTriangles = 4096;
+static const size_t kOccluderTriangleBudget = 16384;
+static const size_t kMaxOccluders = 32;
+
+// Direction the sun shines in, in world space.
+static const filament::math::float3 kSunDirection{ 0.6f, -0.6f, -1.0f };
+
+// Meshes drawn by fewer nodes than this are not worth an instance buffer.
+static const size_t kMinInstances = 4;
+
+// A node with more mesh parts than this spills into further renderables, so
+// that its bounds still cull in pieces.
+static const size_t kMaxPrimitives = 32;
+
+// Splits nodes[begin, end) at the median of their positions until every
+// chunk fits max_instances, so that each chunk is compact enough to cull.
+static void splitInstances(const SceneData &scene, std::vector<uint32_t> &nodes,
+                           size_t begin, size_t end, size_t max_instances,
+                           std::vector<std::vector<uint32_t>> &groups)
+{
+    using namespace filament::math;
+
+    if (end - begin <= max_instances) {
+        groups.emplace_back(nodes.begin() + begin, nodes.begin() + end);
+        return;
+    }
+
+    auto position = [&](uint32_t node) { return scene.nodes[node].transform[3].xyz; };
+    float3 lo = position(nodes[begin]);
+    float3 hi = lo;
+    for (size_t i = begin + 1; i < end; ++i) {
+        lo = min(lo, position(nodes[i]));
+        hi = max(hi, position(nodes[i]));
+    }
+    const float3 extent = hi - lo;
+    int axis = extent.x > extent.y ? 0 : 1;
+    if (extent.z > extent[axis])
+        axis = 2;
+
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(nodes.begin() + begin, nodes.begin() + mid, nodes.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return position(a)[axis] < position(b)[axis]; });
+    splitInstances(scene, nodes, begin, mid, max_instances, groups);
+    splitInstances(scene, nodes, mid, end, max_instances, groups);
+}
+
+// Groups the nodes that draw the same meshes, if none of them has LODs, into
+// chunks of nearby nodes.
+static void findInstanceGroups(const SceneData &scene, size_t max_instances,
+                               std::vector<std::vector<uint32_t>> &groups)
+{
+    std::map<std::vector<uint32_t>, std::vector<uint32_t>> by_meshes;
+    for (size_t n = 0; n < scene.nodes.size(); ++n) {
+        const NodeData &node = scene.nodes[n];
+        if (!node.meshes.empty())
+            by_meshes[node.meshes].push_back(uint32_t(n));
+    }
+
+    for (auto &entry : by_meshes) {
+        std::vector<uint32_t> &nodes = entry.second;
+        if (nodes.size() < kMinInstances)
+            continue;
+        bool instanceable = true;
+        for (uint32_t src_idx : entry.first) {
+            if (src_idx >= scene.meshParts.size()) {
+                instanceable = false;
+                break;
+            }
+            for (uint32_t mesh_idx : scene.meshParts[src_idx]) {
+                instanceable &= mesh_idx < scene.meshes.size() && scene.meshes[mesh_idx].lods.empty();
+            }
+        }
+        if (instanceable)
+            splitInstances(scene, nodes, 0, nodes.size(), max_instances, groups);
+    }
+}
+
 FilamentRenderer::~FilamentRenderer()
 {
+    // initHeadless() failed, nothing was created.
+    if (!mEngine)
+        return;
+
     // Wait until all rendered operations are completed before we destroy
     // anything.
     filament::Fence::waitAndDestroy(mEngine->createFence());
+    endWarmUp();
 
     // destroy root entity.
     mEngine->destroy(mCenterNode);
     mEngine->destroy(mRoot);
 
-    cleanupRenderElements();
+    cancelPendingScene();
+    cleanupRenderElements(mSceneRes);
 
-    mEngine->destroy(mRenderTexture);
+    for (FrameTarget &target : mTargets) {
+        if (target.fence)
+            mEngine->destroy(target.fence);
+        mEngine->destroy(target.target);
+        mEngine->destroy(target.depth);
+        mEngine->destroy(target.color);
+    }
+    mTargets.clear();
+    mPendingTargets.clear();
 
     // destroy light and its entity
     mEngine->getLightManager().destroy(mLight);
     mEngine->destroy(mLight);
 
-    // destroy material
-    mEngine->destroy(mMaterial);
+    // destroy materials
+    mEngine->destroy(mOpaqueMaterial);
+    mEngine->destroy(mMaskedMaterial);
 
     mEngine->destroy(mMainCamera);
     mEngine->destroy(mView);
@@ -60,9 +291,15 @@ FilamentRenderer::~FilamentRenderer()
 }
 
 void FilamentRenderer::set_projection(uint32_t w, uint32_t h) {
+    mViewWidth = w;
+    mViewHeight = h;
+
     // setup projection matrix
-    const float aspect = float(w) / h;
-    mMainCamera->setProjection(mFOV, aspect, 0.1, 10);
+    mAspect = float(w) / h;
+    mMainCamera->setProjection(mFOV, mAspect, 0.1, mFar);
+    mOcclusionCuller.setResolution(OcclusionCuller::kDefaultWidth,
+                                   uint32_t(std::max(OcclusionCuller::kDefaultWidth / mAspect, 1.0f)));
+    mDirty = true;
 }
 
 void FilamentRenderer::resetRootTransform() {
@@ -74,6 +311,7 @@ void FilamentRenderer::resetRootTransform() {
     math::mat4f xform; // identity
     auto& tcm = mEngine->getTransformManager();
     tcm.setTransform(tcm.getInstance(mRoot), xform);
+    mDirty = true;
 
     // reset camera
     mCamManipulator = CameraManipulator({ 0, 0, mZDist},
@@ -82,67 +320,280 @@ void FilamentRenderer::resetRootTransform() {
     mCamManipulator.updateCamera(mMainCamera);
 }
 
-void FilamentRenderer::draw() {
-    while (!mRenderer->beginFrame(mSwapChain))
-        std::this_thread::sleep_for(std::chrono::milliseconds(8));
+void FilamentRenderer::draw()
+{
+    drawFrame();
+}
+
+bool FilamentRenderer::tryDraw()
+{
+    if (mHeadless)
+        return false;
+    if (!mFramePacer.frameDue(FramePacer::Clock::now())) {
+        // hand finished frames over, and time them, as early as possible.
+        pollTargets();
+        return false;
+    }
+    return drawFrame();
+}
+
+bool FilamentRenderer::needsFrame() const
+{
+    return mDirty || mCamManipulator.isDirty() || hasPendingScene() || !mUploads.empty() ||
+           !mPendingTargets.empty() || mWarmUp;
+}
+
+void FilamentRenderer::pollTargets()
+{
+    using namespace filament;
+
+    if (mHeadless)
+        return;
+
+    // frames finish in order, so stop at the first one that has not. The
+    // fences are only polled, never waited on.
+    while (!mPendingTargets.empty()) {
+        FrameTarget &target = mTargets[mPendingTargets.front()];
+        if (target.fence->wait(Fence::Mode::DONT_FLUSH, 0) != Fence::FenceStatus::CONDITION_SATISFIED)
+            break;
+        if (target.timed) {
+            mResolution.frameTimed(std::chrono::duration_cast<std::chrono::microseconds>(
+                FramePacer::Clock::now() - target.started));
+        }
+        mEngine->destroy(target.fence);
+        target.fence = nullptr;
+        mTargetRing->completed(mPendingTargets.front());
+        mPendingTargets.pop_front();
+    }
+}
+
+bool FilamentRenderer::drawFrame()
+{
+    // there is no ring to draw into, see renderImage().
+    if (mHeadless)
+        return false;
+
+    if (hasPendingScene())
+        processPendingScene(mUploadSliceBudget);
+
+    if (!mUploads.empty()) {
+        mUploads.drain(mUploadByteBudget, mUploadTimeBudget);
+        showReadyRenderables(mSceneRes);
+    }
+
+    cullRenderables(mSceneRes);
+    selectLods(mSceneRes);
+
+    // the scene work above is done either way, uploads keep progressing
+    // while the GPU or the GUI catches up.
+    pollTargets();
+    // scenes are only drawn once their materials are compiled.
+    if (stepWarmUp()) {
+        mFramePacer.frameSkipped();
+        return false;
+    }
+    const bool changed = mDirty || mCamManipulator.isDirty();
+    if (!changed && mDrawnScale >= mResolution.maxScale()) {
+        // the last frame is still up to date.
+        mFramePacer.frameIdle(FramePacer::Clock::now());
+        return false;
+    }
+    // a still picture gets drawn once more at full scale.
+    const float scale = changed ? mResolution.scale() : mResolution.maxScale();
+    uint32_t width = 0, height = 0;
+    ResolutionController::extent(scale, mViewWidth, mViewHeight, mTargetWidth, mTargetHeight,
+                                 width, height);
+
+    const int slot = mTargetRing->acquireForWrite();
+    if (slot < 0) {
+        mFramePacer.frameSkipped();
+        return false;
+    }
+    if (!mRenderer->beginFrame(mSwapChain)) {
+        mTargetRing->abortWrite(slot);
+        mFramePacer.frameSkipped();
+        return false;
+    }
+    const auto render_start = std::chrono::steady_clock::now();
+    mView->setViewport({ 0, 0, width, height });
+    mView->setRenderTarget(mTargets[slot].target);
     mRenderer->render(mView);
     mRenderer->endFrame();
-    // if (mRenderer->beginFrame(mSwapChain)) {
-    //     mRenderer->render(mView);
-    //     mRenderer->endFrame();
-    // }
+    mTargets[slot].fence = mEngine->createFence();
+    mTargets[slot].started = render_start;
+    mTargets[slot].timed = changed;
+    mPendingTargets.push_back(slot);
+    mTargetRing->submitted(slot, width, height);
+    mDrawnScale = scale;
+    mDirty = false;
+    mCamManipulator.clearDirty();
+    const auto render_end = std::chrono::steady_clock::now();
+    mOcclusionStats.drawTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        render_end - render_start);
+    mFramePacer.framePresented(render_end);
+
+    if (mFramePacer.presented() % FramePacer::kHistorySize == 0) {
+        const FramePacer::Stats stats = mFramePacer.stats();
+        qInfo() << "Frame times: p50 " << stats.p50.count() / 1000.0 << " ms, p90 "
+                << stats.p90.count() / 1000.0 << " ms, p99 " << stats.p99.count() / 1000.0
+                << " ms, max " << stats.max.count() / 1000.0 << " ms, " << stats.skipped
+                << " frames skipped, " << stats.idle << " idle";
+        const TargetRing::Stats targets = mTargetRing->stats();
+        qInfo() << "Render targets: " << targets.rendered << " rendered, " << targets.displayed
+                << " displayed, " << targets.dropped << " dropped, " << targets.overlapped
+                << " drawn while the GUI sampled, " << targets.stalls << " stalled on the ring";
+        qInfo() << "Resolution: " << width << "x" << height << " at scale " << scale
+                << " of " << mViewWidth << "x" << mViewHeight;
+    }
+    return true;
 }
 
 void FilamentRenderer::resize(uint32_t w, uint32_t h) { set_projection(w, h); }
 
+void FilamentRenderer::setTargetFrameRate(double fps)
+{
+    mFramePacer.setTargetFrameRate(fps);
+    mResolution.setTargetFrameTime(std::chrono::microseconds(
+        fps > 0.0 ? int64_t(1e6 / fps) : 0));
+}
+
+void FilamentRenderer::setResolutionScaleRange(float min_scale, float max_scale)
+{
+    mResolution.setScaleRange(min_scale, max_scale);
+    mDirty = true;
+}
+
+void FilamentRenderer::setNumThreads(unsigned num_threads)
+{
+    mNumThreads = num_threads;
+    mWorkerPool.reset();
+}
+
+WorkerPool& FilamentRenderer::workerPool()
+{
+    if (!mWorkerPool)
+        mWorkerPool = std::make_unique<WorkerPool>(mNumThreads);
+    return *mWorkerPool;
+}
+
 void FilamentRenderer::init(void* nativewindow, void *sharedContext,
-                            int width, int height, unsigned int col_texture_id)
+                            int width, int height, const std::vector<unsigned int> &col_texture_ids,
+                            TargetRing *ring)
 {
+    using namespace filament;
+
     auto backend = filament::Engine::Backend::OPENGL;
     mEngine = filament::Engine::create(backend, nullptr, sharedContext);
     mSwapChain = mEngine->createSwapChain(nullptr);
+
+    // The GUI samples one target while the next frames are drawn into the
+    // others, see TargetRing.
+    mTargetRing = ring;
+    mTargetWidth = uint32_t(width);
+    mTargetHeight = uint32_t(height);
+    const size_t num_targets = std::min(col_texture_ids.size(), ring->size());
+    for (size_t i = 0; i < num_targets; ++i) {
+        FrameTarget target;
+        target.color = Texture::Builder()
+            .width(uint32_t(width))
+            .height(uint32_t(height))
+            .levels(1)
+            .usage(Texture::Usage::COLOR_ATTACHMENT | Texture::Usage::SAMPLEABLE)
+            .format(Texture::InternalFormat::RGB8)
+            .import(col_texture_ids[i])
+            .build(*mEngine);
+        target.depth = Texture::Builder()
+            .width(uint32_t(width))
+            .height(uint32_t(height))
+            .levels(1)
+            .usage(Texture::Usage::DEPTH_ATTACHMENT)
+            .format(Texture::InternalFormat::DEPTH24)
+            .build(*mEngine);
+        target.target = RenderTarget::Builder()
+            .texture(RenderTarget::COLOR, target.color)
+            .texture(RenderTarget::DEPTH, target.depth)
+            .build(*mEngine);
+        mTargets.push_back(target);
+    }
+
+    initScene(width, height);
+
+    // flush back buffer
+    draw();
+}
+
+//------------------------------------------------------------------------------
+
+bool FilamentRenderer::initHeadless(filament::Engine::Backend backend,
+                                    uint32_t width, uint32_t height)
+{
+    using namespace filament;
+
+    mEngine = Engine::create(backend);
+    if (!mEngine) {
+        qCritical() << "Could not create the engine, is there a display or a headless platform?";
+        return false;
+    }
+    mSwapChain = mEngine->createSwapChain(width, height, SwapChain::CONFIG_READABLE);
+    if (!mSwapChain) {
+        qCritical() << "Could not create an off-screen swap chain of " << width << "x" << height;
+        Engine::destroy(&mEngine);
+        return false;
+    }
+    mHeadless = true;
+    mBackend = backend;
+    mTargetWidth = width;
+    mTargetHeight = height;
+
+    initScene(int(width), int(height));
+    finishWarmUp();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::initScene(int width, int height)
+{
+    using namespace filament;
+
     mRenderer = mEngine->createRenderer();
     mMainCamera = mEngine->createCamera();
     mScene = mEngine->createScene();
     mView = mEngine->createView();
 
-    filament::Texture* tex_col = filament::Texture::Builder()
-        .width(100)
-        .height(100)
-        .levels(1)
-        .usage(filament::Texture::Usage::COLOR_ATTACHMENT | filament::Texture::Usage::SAMPLEABLE)
-        .format(filament::Texture::InternalFormat::RGB8)
-        .import(col_texture_id)
-        .build(*mEngine);
-    mRenderTexture = tex_col;
-
-    filament::RenderTarget* target = filament::RenderTarget::Builder()
-        .texture(filament::RenderTarget::COLOR, tex_col)
-        //.texture(filament::RenderTarget::DEPTH, tex_depth)
-        .build(*mEngine);
-
     mView->setClearColor({1.0, 0.125, 0.25, 0.0});
     mView->setScene(mScene);
 
     mView->setViewport({0, 0, static_cast<uint32_t>(width), static_cast<uint32_t>(height) });
-    mView->setRenderTarget(target);
     mView->setCamera(mMainCamera);
 
     set_projection(width, height);
+    setTargetFrameRate(mFramePacer.targetFrameRate());
 
     mLight = utils::EntityManager::get().create();
     filament::LightManager::Builder(filament::LightManager::Type::SUN)
         .color(filament::Color::toLinear<filament::ACCURATE>({0.98f, 0.92f, 0.89f}))
         .intensity(110000)
-        .direction({0.6, -0.6, -1.0})
+        .direction(kSunDirection)
         .castShadows(true)
         .build(*mEngine, mLight);
     mScene->addEntity(mLight);
 
-    // read material.
-    mMaterial =
+    // BC1 is optional on desktop GL and missing on most mobile drivers.
+    mCompressedTexturesSupported =
+        filament::Texture::isTextureFormatSupported(*mEngine, filament::Texture::InternalFormat::DXT1_RGB) &&
+        filament::Texture::isTextureFormatSupported(*mEngine, filament::Texture::InternalFormat::DXT1_SRGB);
+    qInfo() << "Compressed textures supported: " << mCompressedTexturesSupported;
+
+    // read materials. Masking disables early depth rejection, so it is only
+    // used by materials that have a mask.
+    mOpaqueMaterial =
+        filament::Material::Builder().package(RESOURCES_BAKEDTEXTURELIT_DATA, RESOURCES_BAKEDTEXTURELIT_SIZE)
+        .build(*mEngine);
+    mMaskedMaterial =
         filament::Material::Builder().package(RESOURCES_TRANSPARENT_DATA, RESOURCES_TRANSPARENT_SIZE)
         .build(*mEngine);
+    startWarmUp();
 
     // Setup the root node to make transforming the object easier.
     mRoot = utils::EntityManager::get().create();
@@ -151,370 +602,741 @@ void FilamentRenderer::init(void* nativewindow, void *sharedContext,
     auto& tcm = mEngine->getTransformManager();
     tcm.create(mRoot);
     tcm.setTransform(tcm.getInstance(mRoot), root_xform);
-
-    // flush back buffer
-    draw();
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::createRenderMesh(const aiScene *scene, aiMesh const *mesh)
+void FilamentRenderer::startWarmUp()
 {
     using namespace filament;
     using namespace filament::math;
-    using namespace utils;
 
-    float3 const* positions  = reinterpret_cast<float3 const*>(mesh->mVertices);
-    float3 const* tangents   = reinterpret_cast<float3 const*>(mesh->mTangents);
-    float3 const* bitangents = reinterpret_cast<float3 const*>(mesh->mBitangents);
-    float3 const* normals    = reinterpret_cast<float3 const*>(mesh->mNormals);
-    float3 const* texCoords0 = reinterpret_cast<float3 const*>(mesh->mTextureCoords[0]);
+    // The backend compiles a material's programs the first time something
+    // draws with them, which stalls that frame. Draw a triangle with each
+    // material once, off-screen and lit by the shadow casting sun, so that
+    // the color and shadow map variants the scenes use are compiled before
+    // the first scene is shown. One material is drawn per frame and its
+    // fence is polled, see stepWarmUp(), so nothing waits on the compiler.
+    static const float3 positions[3] = { { -1, -1, 0 }, { 1, -1, 0 }, { 0, 1, 0 } };
+    static const float4 tangents[3] = { { 0, 0, 0, 1 }, { 0, 0, 0, 1 }, { 0, 0, 0, 1 } };
+    static const float2 uvs[3] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+    static const uint16_t indices[3] = { 0, 1, 2 };
+
+    mWarmUp.reset(new WarmUp());
+    WarmUp &warm_up = *mWarmUp;
+    warm_up.start = std::chrono::steady_clock::now();
+    warm_up.materials = {
+        { "opaque", mOpaqueMaterial },
+        { "masked", mMaskedMaterial },
+    };
+
+    warm_up.vb = VertexBuffer::Builder()
+        .vertexCount(3)
+        .bufferCount(3)
+        .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+        .attribute(VertexAttribute::TANGENTS, 1, VertexBuffer::AttributeType::FLOAT4)
+        .attribute(VertexAttribute::UV0, 2, VertexBuffer::AttributeType::FLOAT2)
+        .build(*mEngine);
+    warm_up.vb->setBufferAt(*mEngine, 0, VertexBuffer::BufferDescriptor(positions, sizeof(positions)));
+    warm_up.vb->setBufferAt(*mEngine, 1, VertexBuffer::BufferDescriptor(tangents, sizeof(tangents)));
+    warm_up.vb->setBufferAt(*mEngine, 2, VertexBuffer::BufferDescriptor(uvs, sizeof(uvs)));
+    warm_up.ib = IndexBuffer::Builder()
+        .indexCount(3)
+        .bufferType(IndexBuffer::IndexType::USHORT)
+        .build(*mEngine);
+    warm_up.ib->setBuffer(*mEngine, IndexBuffer::BufferDescriptor(indices, sizeof(indices)));
+
+    QImage white(1, 1, QImage::Format_RGBA8888);
+    white.fill(Qt::white);
+    warm_up.texture = Texture::Builder()
+        .width(1)
+        .height(1)
+        .levels(1)
+        .format(Texture::InternalFormat::RGBA8)
+        .build(*mEngine);
+    warm_up.texture->setImage(*mEngine, 0, makePixelBuffer(white));
 
-    const size_t numVertices = mesh->mNumVertices;
+    const uint32_t size = 16;
+    warm_up.color = Texture::Builder()
+        .width(size)
+        .height(size)
+        .levels(1)
+        .usage(Texture::Usage::COLOR_ATTACHMENT | Texture::Usage::SAMPLEABLE)
+        .format(Texture::InternalFormat::RGBA8)
+        .build(*mEngine);
+    warm_up.target = RenderTarget::Builder()
+        .texture(RenderTarget::COLOR, warm_up.color)
+        .build(*mEngine);
 
-    if (numVertices == 0)
-        return;
+    warm_up.scene = mEngine->createScene();
+    warm_up.scene->addEntity(mLight);
+    warm_up.camera = mEngine->createCamera();
+    warm_up.camera->setProjection(mFOV, 1.0, 0.1, 10.0);
+    warm_up.camera->lookAt({ 0, 0, 3 }, { 0, 0, 0 }, { 0, 1, 0 });
+    warm_up.view = mEngine->createView();
+    warm_up.view->setScene(warm_up.scene);
+    warm_up.view->setCamera(warm_up.camera);
+    warm_up.view->setViewport({ 0, 0, size, size });
+    warm_up.view->setRenderTarget(warm_up.target);
+}
 
-    const aiFace* faces = mesh->mFaces;
-    const size_t numFaces = mesh->mNumFaces;
+//------------------------------------------------------------------------------
 
-    if (numFaces == 0)
-        return;
+bool FilamentRenderer::stepWarmUp()
+{
+    using namespace filament;
+    using clock = std::chrono::steady_clock;
+
+    if (!mWarmUp)
+        return false;
+    WarmUp &warm_up = *mWarmUp;
+
+    if (warm_up.fence) {
+        // flushing only hands the fence to the driver, nothing waits here;
+        // no other frame is drawn that would flush it otherwise.
+        if (warm_up.fence->wait(Fence::Mode::FLUSH, 0) != Fence::FenceStatus::CONDITION_SATISFIED)
+            return true;
+        mEngine->destroy(warm_up.fence);
+        warm_up.fence = nullptr;
+        releaseWarmUpInstance();
+        qInfo() << "Warmed up " << warm_up.materials[warm_up.next].first << " material in "
+                << std::chrono::duration<double, std::milli>(clock::now() - warm_up.materialStart).count()
+                << " ms";
+        ++warm_up.next;
+    }
 
-    // copy the relevant data.
-    float3 *vs = new float3[numVertices];
-    float2 *vts = new float2[numVertices];
-    float4 *ts = new float4[numVertices];
-    for (size_t j = 0; j < numVertices; j++) {
-        float3 normal = normals[j];
-        float3 tangent;
-        float3 bitangent;
-
-        // Assimp always returns 3D tex coords but we only support 2D tex coords.
-        float2 texCoord0 = texCoords0 ? texCoords0[j].xy : float2{0.0};
-        // If the tangent and bitangent don't exist, make arbitrary ones. This only
-        // occurs when the mesh is missing texture coordinates, because assimp
-        // computes tangents for us. (search up for aiProcess_CalcTangentSpace)
-        if (!tangents) {
-            bitangent = normalize(cross(normal, float3{1.0, 0.0, 0.0}));
-            tangent = normalize(cross(normal, bitangent));
-        } else {
-            tangent = tangents[j];
-            bitangent = bitangents[j];
+    if (warm_up.next == warm_up.materials.size()) {
+        qInfo() << "Material warm-up: "
+                << std::chrono::duration<double, std::milli>(clock::now() - warm_up.start).count() << " ms";
+        endWarmUp();
+        return false;
+    }
+
+    if (!warm_up.instance) {
+        Material *material = warm_up.materials[warm_up.next].second;
+        warm_up.materialStart = clock::now();
+        warm_up.instance = material->createInstance();
+        for (const char *param : { "albedo", "normalMap", "aoMap", "specMap", "maskMap" }) {
+            if (material->hasParameter(param))
+                warm_up.instance->setParameter(param, warm_up.texture, materialSampler());
         }
 
-        quatf q = filament::math::details::TMat33<float>::packTangentFrame({tangent, bitangent, normal});
-        ts[j] = q.xyzw;
-        vts[j] = texCoord0;
-        vs[j] = positions[j];
+        warm_up.renderable = utils::EntityManager::get().create();
+        RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .material(0, warm_up.instance)
+            .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, warm_up.vb, warm_up.ib, 0, 3)
+            .culling(false)
+            .castShadows(true)
+            .receiveShadows(true)
+            .build(*mEngine, warm_up.renderable);
+        warm_up.scene->addEntity(warm_up.renderable);
     }
 
-    // Populate the index buffer. All faces are triangles at this point because we
-    // asked assimp to perform triangulation.
-    uint32_t *indices = new uint32_t[numFaces * 3];
-    for (size_t j = 0; j < numFaces; ++j) {
-        const aiFace& face = faces[j];
-        for (size_t k = 0; k < face.mNumIndices; ++k) {
-            indices[j*3 + k] = face.mIndices[k];
-        }
+    // like any other frame, try again on the next one if the engine is behind.
+    if (!mRenderer->beginFrame(mSwapChain))
+        return true;
+    mRenderer->render(warm_up.view);
+    mRenderer->endFrame();
+    warm_up.fence = mEngine->createFence();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::finishWarmUp()
+{
+    if (!mWarmUp)
+        return;
+
+    // a headless renderer has nothing else to do meanwhile, so wait for the
+    // GPU between steps. Each material takes a step to draw, retried while
+    // the engine is behind, and one to see its fence signal.
+    const size_t max_steps = (kMaxBeginFrameTries + 1) * mWarmUp->materials.size() + 1;
+    for (size_t i = 0; i < max_steps && stepWarmUp(); ++i)
+        mEngine->flushAndWait();
+
+    if (mWarmUp) {
+        qCritical() << "Material warm-up did not finish, materials compile on first use";
+        endWarmUp();
     }
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::releaseWarmUpInstance()
+{
+    WarmUp &warm_up = *mWarmUp;
+    if (!warm_up.instance)
+        return;
+    warm_up.scene->remove(warm_up.renderable);
+    mEngine->destroy(warm_up.renderable);
+    utils::EntityManager::get().destroy(warm_up.renderable);
+    mEngine->destroy(warm_up.instance);
+    warm_up.instance = nullptr;
+}
+
+//------------------------------------------------------------------------------
 
-    auto aabb = RenderableManager::computeAABB(vs, indices, numFaces, sizeof(float3));
+void FilamentRenderer::endWarmUp()
+{
+    if (!mWarmUp)
+        return;
+
+    WarmUp &warm_up = *mWarmUp;
+    if (warm_up.fence)
+        mEngine->destroy(warm_up.fence);
+    releaseWarmUpInstance();
+    mEngine->destroy(warm_up.view);
+    mEngine->destroy(warm_up.camera);
+    mEngine->destroy(warm_up.scene);
+    mEngine->destroy(warm_up.target);
+    mEngine->destroy(warm_up.color);
+    mEngine->destroy(warm_up.texture);
+    mEngine->destroy(warm_up.ib);
+    mEngine->destroy(warm_up.vb);
+    mWarmUp.reset();
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::createRenderMesh(MeshData &&data, SceneResources &res)
+{
+    using namespace filament;
+    using namespace filament::math;
+    using namespace utils;
+
+    // keep a slot for empty meshes so that indices match the source scene.
+    if (data.empty()) {
+        res.renderMeshes.push_back(RenderMesh());
+        return;
+    }
+
+    const size_t numVertices = data.vertexCount();
+    const size_t numIndices = data.indexCount();
+    const bool compact = data.format == VertexFormat::COMPACT;
 
     // define the vertex buffer
-    auto vb_builder =
-        VertexBuffer::Builder()
-        .vertexCount(numVertices)
-        .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
-        .attribute(VertexAttribute::UV0, 1, VertexBuffer::AttributeType::FLOAT2)
-        .attribute(VertexAttribute::TANGENTS, 2, VertexBuffer::AttributeType::FLOAT4)
-        .bufferCount(3);
+    VertexBuffer::Builder vb_builder;
+    vb_builder.vertexCount(numVertices);
+    if (compact) {
+        // one interleaved buffer, see CompactVertex.
+        const uint8_t stride = sizeof(CompactVertex);
+        vb_builder
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::SHORT4,
+                       offsetof(CompactVertex, position), stride)
+            .normalized(VertexAttribute::POSITION)
+            .attribute(VertexAttribute::TANGENTS, 0, VertexBuffer::AttributeType::SHORT4,
+                       offsetof(CompactVertex, tangents), stride)
+            .normalized(VertexAttribute::TANGENTS)
+            .attribute(VertexAttribute::UV0, 0, VertexBuffer::AttributeType::HALF2,
+                       offsetof(CompactVertex, uv), stride)
+            .bufferCount(1);
+    } else {
+        vb_builder
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .attribute(VertexAttribute::UV0, 1, VertexBuffer::AttributeType::FLOAT2)
+            .attribute(VertexAttribute::TANGENTS, 2, VertexBuffer::AttributeType::FLOAT4)
+            .bufferCount(3);
+    }
     VertexBuffer *vb = vb_builder.build(*mEngine);
 
-    // copy to gpu
-    vb->setBufferAt(*mEngine, 0,
-                    VertexBuffer::BufferDescriptor(vs, numVertices * sizeof(float3),
-                                                   [](void *buffer, size_t, void*) {
-                                                       float3 *data = static_cast<float3*>(buffer);
-                                                       delete[] data;
-                                                   }));
-    vb->setBufferAt(*mEngine, 1,
-                    VertexBuffer::BufferDescriptor(vts, numVertices * sizeof(float2),
-                                                   [](void *buffer, size_t, void*) {
-                                                       float2 *data = static_cast<float2*>(buffer);
-                                                       delete[] data;
-                                                   }));
-    vb->setBufferAt(*mEngine, 2,
-                    VertexBuffer::BufferDescriptor(ts, numVertices * sizeof(float4),
-                                                   [](void *buffer, size_t, void*) {
-                                                       float4 *data = static_cast<float4*>(buffer);
-                                                       delete[] data;
-                                                   }));
     IndexBuffer *ib =
-        IndexBuffer::Builder().indexCount(numFaces * 3)
-        .bufferType(IndexBuffer::IndexType::UINT)
+        IndexBuffer::Builder().indexCount(numIndices)
+        .bufferType(data.hasShortIndices() ? IndexBuffer::IndexType::USHORT
+                                           : IndexBuffer::IndexType::UINT)
         .build(*mEngine);
-    ib->setBuffer(*mEngine,
-                  IndexBuffer::BufferDescriptor(indices, sizeof(uint32_t) * numFaces * 3,
-                                                [](void *buffer, size_t, void*) {
-                                                    uint32_t *data = static_cast<uint32_t*>(buffer);
-                                                    delete[] data;
-                                                }));
+
+    // queue the copies to gpu; the mesh is ready once all of them went through.
+    const uint32_t gen = res.generation;
+    const uint32_t mesh_idx = uint32_t(res.renderMeshes.size());
+    auto staging = std::make_shared<MeshData>(std::move(data));
+    using TakeStream = std::function<VertexBuffer::BufferDescriptor(MeshData&)>;
+    auto uploadVertices = [&](uint8_t buffer, size_t bytes, TakeStream take) {
+        mUploads.enqueue(gen, bytes, [this, vb, staging, buffer, take, gen, mesh_idx]() {
+            vb->setBufferAt(*mEngine, buffer, take(*staging));
+            meshUploaded(gen, mesh_idx);
+        });
+    };
+    if (compact) {
+        uploadVertices(0, numVertices * sizeof(CompactVertex), [](MeshData &d) {
+            return takeStream(d, d.compact, d.mapped.compact, d.vertexCount());
+        });
+    } else {
+        uploadVertices(0, numVertices * sizeof(float3), [](MeshData &d) {
+            return takeStream(d, d.positions, d.mapped.positions, d.vertexCount());
+        });
+        uploadVertices(1, numVertices * sizeof(float2), [](MeshData &d) {
+            return takeStream(d, d.uvs, d.mapped.uvs, d.vertexCount());
+        });
+        uploadVertices(2, numVertices * sizeof(float4), [](MeshData &d) {
+            return takeStream(d, d.tangents, d.mapped.tangents, d.vertexCount());
+        });
+    }
+    mUploads.enqueue(gen, staging->indexBytes(), [this, ib, staging, gen, mesh_idx]() {
+        MeshData &d = *staging;
+        const size_t count = d.indexCount();
+        ib->setBuffer(*mEngine, d.hasShortIndices()
+                      ? takeStream(d, d.shortIndices, d.mapped.shortIndices, count)
+                      : takeStream(d, d.indices, d.mapped.indices, count));
+        meshUploaded(gen, mesh_idx);
+    });
+    const uint32_t uploads = compact ? 2 : 4;
 
     // Keep rendered mesh references for later use
     RenderMesh rm;
     rm.vb = vb;
     rm.ib = ib;
-    rm.indexCount = numFaces * 3;
+    rm.indexCount = numIndices;
+    rm.lods = staging->lods;
+    rm.sources = staging->sources;
+    rm.pendingUploads = uploads;
 
     // compute bounding box
-    rm.aabb = aabb;
-
-    // qInfo() << "mesh " << mesh->mName.C_Str() << " min: " << rm.aabb.getMin()[0] << ", " << rm.aabb.getMin()[1] << ", " << rm.aabb.getMin()[2];
-    // qInfo() << "mesh " << mesh->mName.C_Str() << " max: " << rm.aabb.getMax()[0] << ", " << rm.aabb.getMax()[1] << ", " << rm.aabb.getMax()[2];
-    // qInfo() << "mesh " << mesh->mName.C_Str() << " center " << rm.aabb.center[0] << ", " << rm.aabb.center[1] << ", " << rm.aabb.center[2];
-
-    mRenderMeshes.push_back(rm);
-}
+    rm.aabb = staging->aabb;
+    rm.bounds = staging->uploadedBounds();
+    rm.dequantization = staging->dequantization();
+    if (mOcclusionCulling)
+        rm.occluder = makeOccluderMesh(*staging, kMaxOccluderTriangles);
 
-//------------------------------------------------------------------------------
-
-QImage FilamentRenderer::createOneByOneImage(QImage::Format format,
-                                           const QColor &color)
-{
-    QImage img(1, 1, format);
-    img.setPixelColor(0, 0, color);
-    return img;
+    res.renderMeshes.push_back(rm);
 }
 
 //------------------------------------------------------------------------------
 
 filament::Texture*
-FilamentRenderer::createTexture(QString img_path,
-                              QColor default_color,
-                              QImage::Format format,
-                              filament::Texture::InternalFormat tex_format)
+FilamentRenderer::createTexture(const TextureSource &src)
 {
     using namespace filament;
 
+    if (Texture *cached = mTextureCache.acquire(src.key))
+        return cached;
+
+    QImage::Format format = src.format;
     if (format != QImage::Format_RGB888 && format != QImage::Format_RGBA8888) {
         qCritical() << "Invalid image format: " << format << ". Falling back to RGB888";
         format = QImage::Format_RGB888;
     }
 
-    QImage img;
-    QFileInfo fileinfo(img_path);
-    if (!fileinfo.exists()) {
-        qInfo() << "File does not exist: " << img_path;
-    } else if (!img.load(img_path)) {
-        qInfo() << "Could not load image at: " << img_path;
+    if (src.compressed && mCompressedTexturesSupported)
+        return uploadCompressedTexture(src);
+
+    // Images are normally decoded in parallel by buildSceneData(), only decode
+    // here if that did not happen.
+    if (src.image.isNull() || !src.mips || src.image.format() != format) {
+        TextureSource decoded = src;
+        decoded.format = format;
+        decodeTexture(decoded);
+        return uploadTexture(decoded);
     }
 
-    // ensure correct format
-    img = img.convertToFormat(format);
+    return uploadTexture(src);
+}
 
-    if (img.isNull()){
-        // Create empty texture
-        qInfo() << "Creating default texture";
-        img = createOneByOneImage(format, default_color);
-    }
+//------------------------------------------------------------------------------
 
-    unsigned char* img_data = new unsigned char[img.sizeInBytes()];
-    memcpy(img_data, img.bits(), img.sizeInBytes());
+filament::Texture*
+FilamentRenderer::uploadTexture(const TextureSource &src)
+{
+    using namespace filament;
 
-    Texture::Format pixel_buffer_format = Texture::Format::RGB;
-    if (format == QImage::Format_RGB888) {
-        pixel_buffer_format = Texture::Format::RGB;
-    } else if (format == QImage::Format_RGBA8888) {
-        pixel_buffer_format = Texture::Format::RGBA;
-    } else {
-        qCritical() << "Invalid image format: " << format;
-    }
+    const QImage &img = src.image;
+    const std::string &key = src.key;
+    const Texture::InternalFormat tex_format = src.texFormat;
+    std::shared_ptr<const std::vector<MipLevel>> mips = src.mips;
+    const size_t levels = 1 + (mips ? mips->size() : 0);
 
-    Texture::PixelBufferDescriptor buffer(img_data,
-                                          size_t(img.width() * img.height() * 4),
-                                          pixel_buffer_format,
-                                          Texture::Type::UBYTE,
-                                          [](void* buffer, size_t, void*) {
-                                              unsigned char* data =
-                                                  static_cast<unsigned char*>(buffer);
-                                              delete[] data;
-                                          });
     Texture* tex = Texture::Builder()
         .width(uint32_t(img.width()))
         .height(uint32_t(img.height()))
+        .levels(uint8_t(levels))
+        .sampler(Texture::Sampler::SAMPLER_2D)
+        .format(tex_format)
+        .build(*mEngine);
+
+    TextureCache::Entry entry;
+    entry.texture = tex;
+
+    if (img.width() <= kPlaceholderSize && img.height() <= kPlaceholderSize) {
+        setTextureImages(*mEngine, tex, img, mips);
+        mTextureCache.insert(key, entry);
+        return tex;
+    }
+
+    // Show a small version of the image right away and stream the full one
+    // through the upload queue. Materials bind the placeholder until then.
+    QImage small = img.scaled(std::min(img.width(), kPlaceholderSize),
+                              std::min(img.height(), kPlaceholderSize),
+                              Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+        .convertToFormat(img.format());
+    Texture* placeholder = Texture::Builder()
+        .width(uint32_t(small.width()))
+        .height(uint32_t(small.height()))
         .levels(1)
         .sampler(Texture::Sampler::SAMPLER_2D)
         .format(tex_format)
         .build(*mEngine);
-    tex->setImage(*mEngine, 0, std::move(buffer));
+    placeholder->setImage(*mEngine, 0, makePixelBuffer(small));
+
+    // The texture may outlive the scene that loaded it, so its upload gets its
+    // own tag and is only cancelled when the last user releases it.
+    entry.placeholder = placeholder;
+    entry.uploadTag = mNextTextureUploadTag++;
+    mTextureCache.insert(key, entry);
+
+    size_t bytes = size_t(img.sizeInBytes());
+    for (size_t level = 0; mips && level < mips->size(); ++level) {
+        bytes += (*mips)[level].pixels.size();
+    }
+    mUploads.enqueue(entry.uploadTag, bytes, [this, tex, img, mips]() {
+        setTextureImages(*mEngine, tex, img, mips);
+        textureUploaded(tex);
+    });
 
     return tex;
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::createMaterials(const aiScene *scene,
-                                     const aiMaterial *mat,
-                                     const std::string &basedir)
+filament::Texture*
+FilamentRenderer::uploadCompressedTexture(const TextureSource &src)
 {
     using namespace filament;
 
-    qInfo() << "Basedir: " << basedir.c_str();
+    std::shared_ptr<const CompressedTexture> chain = src.compressed;
+    const bool srgb = src.texFormat == Texture::InternalFormat::SRGB8_A8;
+    const Texture::InternalFormat tex_format = srgb
+        ? Texture::InternalFormat::DXT1_SRGB : Texture::InternalFormat::DXT1_RGB;
+    const Texture::CompressedType type = srgb
+        ? Texture::CompressedType::DXT1_SRGB : Texture::CompressedType::DXT1_RGB;
+    const size_t levels = chain->levels.size();
+
+    Texture* tex = Texture::Builder()
+        .width(chain->width)
+        .height(chain->height)
+        .levels(uint8_t(levels))
+        .sampler(Texture::Sampler::SAMPLER_2D)
+        .format(tex_format)
+        .build(*mEngine);
+
+    TextureCache::Entry entry;
+    entry.texture = tex;
+
+    auto upload = [this, tex, chain, type, levels]() {
+        for (size_t level = 0; level < levels; ++level) {
+            tex->setImage(*mEngine, uint8_t(level), makeCompressedBuffer(chain, level, type));
+        }
+    };
+
+    // The tail of the chain already holds a small version of the image, so
+    // the placeholder is just its first level that fits.
+    size_t first = 0;
+    while (first + 1 < levels &&
+           std::max(chain->width >> first, chain->height >> first) > uint32_t(kPlaceholderSize)) {
+        ++first;
+    }
+    if (first == 0) {
+        upload();
+        mTextureCache.insert(src.key, entry);
+        return tex;
+    }
+
+    Texture* placeholder = Texture::Builder()
+        .width(std::max(1u, chain->width >> first))
+        .height(std::max(1u, chain->height >> first))
+        .levels(1)
+        .sampler(Texture::Sampler::SAMPLER_2D)
+        .format(tex_format)
+        .build(*mEngine);
+    placeholder->setImage(*mEngine, 0, makeCompressedBuffer(chain, first, type));
+
+    entry.placeholder = placeholder;
+    entry.uploadTag = mNextTextureUploadTag++;
+    mTextureCache.insert(src.key, entry);
+
+    mUploads.enqueue(entry.uploadTag, chain->byteSize(), [this, tex, upload]() {
+        upload();
+        textureUploaded(tex);
+    });
+
+    return tex;
+}
+
+//------------------------------------------------------------------------------
+
+static std::string materialKey(const MaterialData &mat)
+{
+    // the textures are all there is to a material, their cache keys name
+    // the files and how they are decoded.
+    std::string key = mat.masked ? "masked" : "opaque";
+    for (const TextureSource *src : { &mat.albedo, &mat.normalMap, &mat.aoMap,
+                                      &mat.specMap, &mat.maskMap }) {
+        key += '\n';
+        key += src->key;
+    }
+    return key;
+}
 
-    QImage img;
-    std::string texpath;
-    if (mat->GetTextureCount(aiTextureType_DIFFUSE)) {
-        aiString tex_path;
-        mat->GetTexture(aiTextureType_DIFFUSE, 0, &tex_path);
+//------------------------------------------------------------------------------
 
-        QString imgpathstr(tex_path.C_Str());
-        auto tokens = imgpathstr.split(QRegExp("\\\\|/"));
-        qInfo() << tokens;
+void FilamentRenderer::createMaterials(const MaterialData &mat, SceneResources &res)
+{
+    using namespace filament;
 
-        //texpath = basedir + "/Textures/" + img_path.fileName().toStdString();
-        texpath = basedir + "/Textures/" + tokens.last().toStdString();
+    // materials that bind the same textures share an instance.
+    const std::string key = materialKey(mat);
+    auto shared = res.uniqueInstances.find(key);
+    if (shared != res.uniqueInstances.end()) {
+        res.textures.push_back(MatTextures());
+        res.materialInstances.push_back(shared->second);
+        return;
     }
 
     MatTextures textures;
 
-    textures.albedoFilepath = QString(texpath.c_str());
-    textures.albedo = createTexture(texpath.c_str(),
-                                    Qt::white,
-                                    QImage::Format_RGBA8888,
-                                    Texture::InternalFormat::SRGB8_A8);
+    // uploaded in material order from the images decoded by buildSceneData().
+    textures.albedoFilepath = QString(mat.albedoPath.c_str());
+    textures.albedo = createTexture(mat.albedo);
+    textures.normalMap = createTexture(mat.normalMap);
+    textures.aoMap = createTexture(mat.aoMap);
+    textures.specMap = createTexture(mat.specMap);
+    if (mat.masked)
+        textures.maskMap = createTexture(mat.maskMap);
 
-    textures.normalMap = createTexture((basedir + "/Textures/normal.jpg").c_str(),
-                                       QColor(127, 127, 255),
-                                       QImage::Format_RGB888,
-                                       Texture::InternalFormat::RGB8);
+    res.textures.push_back(textures);
 
-    textures.aoMap = createTexture((basedir + "/Textures/ao.jpg").c_str(),
-                                   Qt::white,
-                                   QImage::Format_RGB888,
-                                   Texture::InternalFormat::RGB8);
+    MaterialInstance *mat_inst = (mat.masked ? mMaskedMaterial : mOpaqueMaterial)->createInstance();
 
-    textures.specMap = createTexture((basedir + "/Textures/spec.jpg").c_str(),
-                                     Qt::black,
-                                     QImage::Format_RGB888,
-                                     Texture::InternalFormat::RGB8);
+    bindTexture(res, mat_inst, "albedo", textures.albedo);
+    bindTexture(res, mat_inst, "normalMap", textures.normalMap);
+    bindTexture(res, mat_inst, "aoMap", textures.aoMap);
+    bindTexture(res, mat_inst, "specMap", textures.specMap);
+    bindTexture(res, mat_inst, "maskMap", textures.maskMap);
 
-    textures.maskMap = createTexture((basedir + "/Textures/mask.jpg").c_str(),
-                                     Qt::white,
-                                     QImage::Format_RGB888,
-                                     Texture::InternalFormat::RGB8);
+    res.uniqueInstances.emplace(key, mat_inst);
+    res.materialInstances.push_back(mat_inst);
+}
+
+//------------------------------------------------------------------------------
 
+void FilamentRenderer::bindTexture(SceneResources &res,
+                                   filament::MaterialInstance *mat_inst,
+                                   const char *param,
+                                   filament::Texture *tex)
+{
+    if (!tex || !mat_inst->getMaterial()->hasParameter(param))
+        return;
 
-    mTextures.push_back(textures);
+    filament::Texture *placeholder = mTextureCache.placeholder(tex);
+    if (placeholder) {
+        // rebound in textureUploaded() once the full image is in.
+        mat_inst->setParameter(param, placeholder, materialSampler());
+        res.textureBindings[tex].push_back({mat_inst, param});
+    } else {
+        mat_inst->setParameter(param, tex, materialSampler());
+    }
+}
 
-    MaterialInstance *mat_inst = mMaterial->createInstance();
+//------------------------------------------------------------------------------
 
-    if (textures.albedo && mat_inst->getMaterial()->hasParameter("albedo")) {
-        TextureSampler sampler(TextureSampler::MinFilter::LINEAR,
-                               TextureSampler::MagFilter::LINEAR,
-                               TextureSampler::WrapMode::REPEAT);  // repeat is needed
-        mat_inst->setParameter("albedo", textures.albedo, sampler);
+void FilamentRenderer::createRenderables(const SceneData &scene,
+                                         const NodeData &node,
+                                         SceneResources &res)
+{
+    std::vector<std::vector<uint32_t>> groups;
+    renderableGroups(scene, node.meshes, res, groups);
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const std::vector<uint32_t> &parts = groups[g];
+        addRenderable(scene, parts, g == 0 ? node.name : node.name + " #" + std::to_string(g),
+                      node.transform * res.renderMeshes[parts[0]].dequantization, nullptr, res);
     }
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::createInstancedRenderable(const SceneData &scene,
+                                                 const std::vector<uint32_t> &nodes,
+                                                 SceneResources &res)
+{
+    const NodeData &first = scene.nodes[nodes[0]];
+    std::vector<std::vector<uint32_t>> groups;
+    renderableGroups(scene, first.meshes, res, groups);
+
+    // Each instance is placed exactly like its own renderable would be, so
+    // the result is the same as drawing the nodes one by one.
+    std::vector<filament::math::mat4f> instances;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const std::vector<uint32_t> &parts = groups[g];
+        const filament::math::mat4f &dequantization = res.renderMeshes[parts[0]].dequantization;
+        instances.clear();
+        for (uint32_t node_idx : nodes) {
+            instances.push_back(scene.nodes[node_idx].transform * dequantization);
+        }
 
-    if (textures.normalMap && mat_inst->getMaterial()->hasParameter("normalMap")) {
-        TextureSampler sampler(TextureSampler::MinFilter::LINEAR,
-                               TextureSampler::MagFilter::LINEAR,
-                               TextureSampler::WrapMode::REPEAT);  // repeat is needed
-        mat_inst->setParameter("normalMap", textures.normalMap, sampler);
+        std::string name = first.name + " x" + std::to_string(nodes.size());
+        if (g > 0)
+            name += " #" + std::to_string(g);
+        addRenderable(scene, parts, name, filament::math::mat4f(), &instances, res);
     }
+}
+
+//------------------------------------------------------------------------------
 
-    if (textures.aoMap && mat_inst->getMaterial()->hasParameter("aoMap")) {
-        TextureSampler sampler(TextureSampler::MinFilter::LINEAR,
-                               TextureSampler::MagFilter::LINEAR,
-                               TextureSampler::WrapMode::REPEAT);  // repeat is needed
-        mat_inst->setParameter("aoMap", textures.aoMap, sampler);
+bool FilamentRenderer::renderableParts(const SceneData &scene, size_t src_idx,
+                                       const SceneResources &res,
+                                       std::vector<uint32_t> &parts)
+{
+    if (src_idx >= scene.meshParts.size()) {
+        qCritical() << "mesh index: " << src_idx << " greater than num meshes: "<< scene.meshParts.size();
+        return false;
     }
 
-    if (textures.specMap && mat_inst->getMaterial()->hasParameter("specMap")) {
-        TextureSampler sampler(TextureSampler::MinFilter::LINEAR,
-                               TextureSampler::MagFilter::LINEAR,
-                               TextureSampler::WrapMode::REPEAT);  // repeat is needed
-        mat_inst->setParameter("specMap", textures.specMap, sampler);
+    // every part of the mesh becomes a primitive.
+    const size_t first = parts.size();
+    for (uint32_t mesh_idx : scene.meshParts[src_idx]) {
+        if (mesh_idx >= res.renderMeshes.size()) {
+            qCritical() << "mesh index: " << mesh_idx << " greater than num render meshes: "<< res.renderMeshes.size();
+            parts.resize(first);
+            return false;
+        }
+
+        size_t mat_idx = scene.meshMaterials[mesh_idx];
+        if (mat_idx >= res.materialInstances.size()) {
+            qCritical() << "material index: " << mat_idx << " greater than num materials: "<< res.materialInstances.size();
+            parts.resize(first);
+            return false;
+        }
+
+        // skip parts without geometry
+        if (res.renderMeshes[mesh_idx].vb)
+            parts.push_back(mesh_idx);
     }
 
-    if (textures.maskMap && mat_inst->getMaterial()->hasParameter("maskMap")) {
-        TextureSampler sampler(TextureSampler::MinFilter::LINEAR,
-                               TextureSampler::MagFilter::LINEAR,
-                               TextureSampler::WrapMode::REPEAT);  // repeat is needed
-        mat_inst->setParameter("maskMap", textures.maskMap, sampler);
+    // false if the mesh had no geometry
+    return parts.size() > first;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::renderableGroups(const SceneData &scene, const std::vector<uint32_t> &meshes,
+                                        const SceneResources &res,
+                                        std::vector<std::vector<uint32_t>> &groups)
+{
+    groups.clear();
+    std::vector<uint32_t> parts;
+    for (uint32_t src_idx : meshes) {
+        const size_t first = parts.size();
+        if (!renderableParts(scene, src_idx, res, parts) || scene.meshParts[src_idx].size() < 2)
+            continue;
+        // the parts of a split mesh are culled on their own, each against
+        // its tight box, so they get a renderable each.
+        for (size_t i = first; i < parts.size(); ++i) {
+            groups.push_back({ parts[i] });
+        }
+        parts.resize(first);
     }
 
-    mMaterialInstances.push_back(mat_inst);
+    // Parts quantized in the same frame, like meshes that share a node, can
+    // be drawn with the same transform.
+    for (uint32_t mesh_idx : parts) {
+        const filament::math::mat4f &dequantization = res.renderMeshes[mesh_idx].dequantization;
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const std::vector<uint32_t> &g) {
+            return g.size() < kMaxPrimitives && res.renderMeshes[g[0]].dequantization == dequantization;
+        });
+        if (group == groups.end())
+            group = groups.emplace(groups.end());
+        group->push_back(mesh_idx);
+    }
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::createRenderables(const aiScene *scene,
-                                       aiNode const *node,
-                                       aiMatrix4x4 accTransform)
+void FilamentRenderer::addRenderable(const SceneData &scene, const std::vector<uint32_t> &parts,
+                                     const std::string &name, const filament::math::mat4f &transform,
+                                     const std::vector<filament::math::mat4f> *instances,
+                                     SceneResources &res)
 {
     using namespace filament;
 
-    aiMatrix4x4 transform = accTransform * node->mTransformation;
-
     auto &tcm = mEngine->getTransformManager();
 
-    // if the node has meshes, then create renderables
-    if (node->mNumMeshes > 0) {
+    utils::Entity renderable = utils::EntityManager::get().create();
 
-        size_t mesh_idx = node->mMeshes[0];
-        size_t mat_idx  = scene->mMeshes[mesh_idx]->mMaterialIndex;
+    if (!renderable) {
+        qCritical() << "Could not create renderable entity";
+        return;
+    }
 
-        if (mesh_idx >= mRenderMeshes.size()) {
-            qCritical() << "mesh index: " << mesh_idx << " greater than num render meshes: "<< mRenderMeshes.size();
-        } else if (mat_idx >= mMaterialInstances.size()) {
-            qCritical() << "material index: " << mesh_idx << " greater than num materials: "<< mMaterialInstances.size();
-        } else {
-            RenderMesh &rm = mRenderMeshes[mesh_idx];
-            MaterialInstance *mat = mMaterialInstances[mat_idx];
-            utils::Entity renderable = utils::EntityManager::get().create();
-
-            if (!renderable) {
-                qCritical() << "Could not create renderable entity";
-            } else {
-                RenderableManager::Builder builder(1);
-                builder.boundingBox(rm.aabb)
-                    .material(0, mat)
-                    .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, rm.vb, rm.ib, 0, rm.indexCount)
-                    .culling(false)
-                    .castShadows(true)
-                    .receiveShadows(true);
-                auto result = builder.build(*mEngine, renderable);
-                if (result != RenderableManager::Builder::Success) {
-                    qCritical() << "Could not create renderable: " << node->mName.C_Str();
-                    utils::EntityManager::get().destroy(renderable);
-                } else {
-                    mRenderables.push_back(renderable);
-                    mScene->addEntity(renderable);
-
-                    // Set the global transform for this node.
-                    math::mat4f xform;
-                    for (int i = 0; i < 4; ++i) {
-                        for (int j = 0; j < 4; ++j) {
-                            // note that aiMatrix is row-major and mat4f is col-major
-                            xform[i][j] = transform[j][i];
-                            //std::cout << transform[i][j] << ", ";
-                        }
-                        //std::cout << std::endl;
-                    }
-                    tcm.setTransform(tcm.getInstance(renderable), xform);
-                    //tcm.setParent(tcm.getInstance(renderable), tcm.getInstance(mRoot));
-
-                    qInfo() << "Created renderable: " << node->mName.C_Str();
-                }
-            }
+    // The parts share their quantization, so they can share the renderable's
+    // transform, see renderableGroups().
+    Box bounds = res.renderMeshes[parts[0]].bounds;
+    RenderableManager::Builder builder(parts.size());
+    for (size_t i = 0; i < parts.size(); ++i) {
+        const RenderMesh &rm = res.renderMeshes[parts[i]];
+        bounds.unionSelf(rm.bounds);
+        // start at the finest LOD, selectLods() picks from the next frame on.
+        const size_t count = rm.lods.empty() ? rm.indexCount : rm.lods[0].count;
+        builder.material(i, res.materialInstances[scene.meshMaterials[parts[i]]])
+            .geometry(i, RenderableManager::PrimitiveType::TRIANGLES, rm.vb, rm.ib, 0, count);
+    }
 
+    uint32_t instance_count = 1;
+#ifdef HAVE_FILAMENT_INSTANCING
+    if (instances) {
+        // the bounds have to cover every instance.
+        Box instance_bounds = rigidTransform(bounds, (*instances)[0]);
+        for (const math::mat4f &instance : *instances) {
+            instance_bounds.unionSelf(rigidTransform(bounds, instance));
         }
+        bounds = instance_bounds;
+
+        InstanceBuffer *instance_buffer = InstanceBuffer::Builder(instances->size())
+            .localTransforms(instances->data())
+            .build(*mEngine);
+        res.instanceBuffers.push_back(instance_buffer);
+        builder.instances(instances->size(), instance_buffer);
+        instance_count = uint32_t(instances->size());
+    }
+#else
+    Q_ASSERT(!instances);
+#endif
+
+    builder.boundingBox(bounds)
+        .culling(mFrustumCulling)
+        .castShadows(true)
+        .receiveShadows(true);
+    auto result = builder.build(*mEngine, renderable);
+    if (result != RenderableManager::Builder::Success) {
+        qCritical() << "Could not create renderable: " << name.c_str();
+        utils::EntityManager::get().destroy(renderable);
+        return;
     }
 
-    for (unsigned i = 0; i < node->mNumChildren; ++i) {
-        createRenderables(scene, node->mChildren[i], transform);
+    // The renderable is only added to the scene once the scene is current and
+    // its mesh data has been uploaded, see showReadyRenderables().
+    res.hiddenRenderables.push_back({uint32_t(res.renderables.size()), parts});
+    res.renderables.push_back(renderable);
+    res.ready.push_back(0);
+    res.visible.push_back(1);
+    res.inScene.push_back(0);
+
+    SceneResources::CullInfo info;
+    info.meshes = parts;
+    for (uint32_t mesh_idx : parts) {
+        const RenderMesh &rm = res.renderMeshes[mesh_idx];
+        info.triangles += (rm.lods.empty() ? rm.indexCount : rm.lods[0].count) / 3 * instance_count;
+    }
+    info.instanced = instances != nullptr;
+    res.cullInfo.push_back(std::move(info));
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (!res.renderMeshes[parts[i]].lods.empty())
+            res.lodPrimitives.push_back({renderable, uint32_t(i), parts[i], 0});
     }
+
+    // Set the global transform for this node.
+    tcm.setTransform(tcm.getInstance(renderable), transform);
+
+    qInfo() << "Created renderable: " << name.c_str();
 }
 
 //------------------------------------------------------------------------------
@@ -528,7 +1350,7 @@ void FilamentRenderer::centerCamera()
     // Global bbox
     Box bbox;
 
-    for (utils::Entity e : mRenderables) {
+    for (utils::Entity e : mSceneRes.renderables) {
         math::mat4f xform = tcm.getWorldTransform(tcm.getInstance(e));
         Box aabb = rcm.getAxisAlignedBoundingBox(rcm.getInstance(e));
 
@@ -555,11 +1377,18 @@ void FilamentRenderer::centerCamera()
     tcm.setTransform(tcm.getInstance(mCenterNode), xform);
 
     // set parent root xform
-    for (utils::Entity e : mRenderables) {
+    for (utils::Entity e : mSceneRes.renderables) {
         tcm.setParent(tcm.getInstance(e), tcm.getInstance(mCenterNode));
     }
     tcm.setParent(tcm.getInstance(mCenterNode), tcm.getInstance(mRoot));
 
+    buildCullHierarchy(mSceneRes);
+
+    // keep the whole scene in front of the far plane the engine culls with,
+    // with room to dolly out.
+    mFar = float(std::max(10.0, 4.0 * (zdist + r)));
+    mMainCamera->setProjection(mFOV, mAspect, 0.1, mFar);
+
     mZDist = zdist;
     mCamManipulator = CameraManipulator({ 0, 0, zdist},
                                         { 0, 0, 0 },
@@ -569,49 +1398,67 @@ void FilamentRenderer::centerCamera()
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::cleanupTextures()
+void FilamentRenderer::cleanupTextures(SceneResources &res)
 {
-    for (auto mat_texs : mTextures) {
-        if (mat_texs.albedo)
-            mEngine->destroy(mat_texs.albedo);
-        if (mat_texs.normalMap)
-            mEngine->destroy(mat_texs.normalMap);
-        if (mat_texs.aoMap)
-            mEngine->destroy(mat_texs.aoMap);
-        if (mat_texs.specMap)
-            mEngine->destroy(mat_texs.specMap);
-        if (mat_texs.maskMap)
-            mEngine->destroy(mat_texs.maskMap);
+    for (const MatTextures &mat_texs : res.textures) {
+        releaseTexture(mat_texs.albedo);
+        releaseTexture(mat_texs.normalMap);
+        releaseTexture(mat_texs.aoMap);
+        releaseTexture(mat_texs.specMap);
+        releaseTexture(mat_texs.maskMap);
     }
-    mTextures.clear();
+    res.textures.clear();
+    res.textureBindings.clear();
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::releaseTexture(filament::Texture *tex)
+{
+    if (!tex)
+        return;
+
+    // only destroy the texture once no material uses it anymore.
+    TextureCache::Entry entry;
+    if (!mTextureCache.release(tex, entry))
+        return;
+
+    if (entry.uploadTag)
+        mUploads.cancel(entry.uploadTag);
+    if (entry.placeholder)
+        mEngine->destroy(entry.placeholder);
+    mEngine->destroy(entry.texture);
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::cleanupMaterials()
+void FilamentRenderer::cleanupMaterials(SceneResources &res)
 {
-    for (filament::MaterialInstance *mat : mMaterialInstances) {
-        mEngine->destroy(mat);
+    for (const auto &entry : res.uniqueInstances) {
+        mEngine->destroy(entry.second);
     }
-    mMaterialInstances.clear();
+    res.uniqueInstances.clear();
+    res.materialInstances.clear();
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::cleanupRenderMeshes()
+void FilamentRenderer::cleanupRenderMeshes(SceneResources &res)
 {
-    for (RenderMesh &rm : mRenderMeshes) {
-        mEngine->destroy(rm.vb);
-        mEngine->destroy(rm.ib);
+    for (RenderMesh &rm : res.renderMeshes) {
+        if (rm.vb)
+            mEngine->destroy(rm.vb);
+        if (rm.ib)
+            mEngine->destroy(rm.ib);
     }
-    mRenderMeshes.clear();
+    res.renderMeshes.clear();
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::cleanupRenderables()
+void FilamentRenderer::cleanupRenderables(SceneResources &res)
 {
-    for (utils::Entity e : mRenderables) {
+    for (utils::Entity e : res.renderables) {
         mScene->remove(e);
 
         mEngine->destroy(e);
@@ -619,50 +1466,609 @@ void FilamentRenderer::cleanupRenderables()
         // destroy entities themselves
         utils::EntityManager::get().destroy(e);
     }
-    mRenderables.clear();
+    res.renderables.clear();
+#ifdef HAVE_FILAMENT_INSTANCING
+    for (filament::InstanceBuffer *buffer : res.instanceBuffers) {
+        mEngine->destroy(buffer);
+    }
+    res.instanceBuffers.clear();
+#endif
+    res.hiddenRenderables.clear();
+    res.ready.clear();
+    res.visible.clear();
+    res.inScene.clear();
+    res.cullInfo.clear();
+    res.bvh.clear();
+    res.lodPrimitives.clear();
 }
 
 //------------------------------------------------------------------------------
 
-void FilamentRenderer::cleanupRenderElements()
+void FilamentRenderer::cleanupRenderElements(SceneResources &res)
 {
+    // drop uploads that still reference these objects.
+    mUploads.cancel(res.generation);
+
     // Wait until all rendered operations are completed before we destroy
     // anything.
     filament::Fence::waitAndDestroy(mEngine->createFence());
 
-    cleanupRenderables();
-    cleanupRenderMeshes();
-    cleanupMaterials();
-    cleanupTextures();
+    cleanupRenderables(res);
+    cleanupRenderMeshes(res);
+    cleanupMaterials(res);
+    cleanupTextures(res);
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::setRootTransform(const filament::math::mat4f &transform)
+{
+    auto &tcm = mEngine->getTransformManager();
+    tcm.setTransform(tcm.getInstance(mRoot), transform);
+    mDirty = true;
 }
 
 //------------------------------------------------------------------------------
 
 void FilamentRenderer::setScene(const aiScene *scene, std::string filename)
 {
-    // cleanup existing render elements
-    cleanupRenderElements();
+    std::unique_ptr<SceneData> data(new SceneData());
+    if (!buildSceneData(scene, filename, workerPool(), *data, sceneBuildOptions()))
+        return;
 
-    QFileInfo fileinfo(QString(filename.c_str()));
+    setSceneDataNow(std::move(data));
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::setSceneDataNow(std::unique_ptr<SceneData> data)
+{
+    setSceneData(std::move(data));
 
-    // Create material textures
-    for (unsigned int i = 0; i < scene->mNumMaterials; ++i) {
-        std::string basedir = fileinfo.dir().canonicalPath().toStdString();
-        aiMaterial *mat = scene->mMaterials[i];
-        createMaterials(scene, mat, basedir);
+    // create and upload everything right away.
+    while (hasPendingScene()) {
+        processPendingScene(std::chrono::microseconds::max());
+        mUploads.flush();
     }
+    showReadyRenderables(mSceneRes);
+    // the engine copies the buffers later; wait so the upload is done on return.
+    mEngine->flushAndWait();
+}
+
+//------------------------------------------------------------------------------
 
-    // create meshes
-    for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
-        createRenderMesh(scene, scene->mMeshes[i]);
+bool FilamentRenderer::beginHeadlessFrame()
+{
+    // the engine skips a frame while the GPU is behind; nothing is waiting
+    // on a headless renderer, so let the GPU catch up and try again.
+    for (int i = 0; i < kMaxBeginFrameTries; ++i) {
+        if (mRenderer->beginFrame(mSwapChain))
+            return true;
+        mEngine->flushAndWait();
     }
+    return false;
+}
 
-    // create renderables from meshes
-    if (!scene->mRootNode) {
-        qCritical() << "No root found in scene";
-        return;
+//------------------------------------------------------------------------------
+
+bool FilamentRenderer::renderImage(QImage &image)
+{
+    using namespace filament;
+
+    if (!mHeadless)
+        return false;
+
+    const uint32_t width = mTargetWidth;
+    const uint32_t height = mTargetHeight;
+    mView->setViewport({ 0, 0, width, height });
+    cullRenderables(mSceneRes);
+    selectLods(mSceneRes);
+
+    // The release callback runs whenever the engine gets to it, possibly
+    // after this returns; it owns a reference to the pixels it reports on.
+    struct ReadBack {
+        QImage frame;
+        bool read = false;
+    };
+    auto read_back = std::make_shared<ReadBack>();
+    read_back->frame = QImage(int(width), int(height), QImage::Format_RGBA8888);
+    read_back->frame.fill(Qt::transparent);
+    Texture::PixelBufferDescriptor pixels(read_back->frame.bits(),
+                                          size_t(read_back->frame.sizeInBytes()),
+                                          Texture::Format::RGBA,
+                                          Texture::Type::UBYTE,
+                                          [](void*, size_t, void* user) {
+                                              auto *owner = static_cast<std::shared_ptr<ReadBack>*>(user);
+                                              (*owner)->read = true;
+                                              delete owner;
+                                          }, new std::shared_ptr<ReadBack>(read_back));
+
+    if (!beginHeadlessFrame()) {
+        qCritical() << "The engine did not start a frame";
+        return false;
+    }
+    mRenderer->render(mView);
+    mRenderer->readPixels(0, 0, width, height, std::move(pixels));
+    mRenderer->endFrame();
+
+    // the callback is called from the engine's message queues once the
+    // read is done.
+    mEngine->flushAndWait();
+    mEngine->pumpMessageQueues();
+    // the NOOP driver releases the buffer without writing to it.
+    if (!read_back->read || mBackend == Engine::Backend::NOOP)
+        return false;
+
+    // GL reads rows bottom up.
+    image = read_back->frame.mirrored();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+SceneBuildOptions FilamentRenderer::sceneBuildOptions() const
+{
+    SceneBuildOptions options;
+    options.compressTextures = mTextureCompression && mCompressedTexturesSupported;
+    options.compressedCacheDir = defaultCompressedCacheDir();
+    options.sceneCacheDir = defaultSceneCacheDir();
+    options.vertexFormat = mVertexFormat;
+    options.batchStaticMeshes = mStaticBatching;
+    return options;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::setSceneData(std::unique_ptr<SceneData> data)
+{
+    cancelPendingScene();
+
+    mPending.data = std::move(data);
+    mPending.res.generation = ++mGeneration;
+    mPending.nextMaterial = 0;
+    mPending.nextMesh = 0;
+    mPending.nextNode = 0;
+    mPending.nextGroup = 0;
+    mPending.instanceGroups.clear();
+    mPending.instancedNodes.assign(mPending.data->nodes.size(), 0);
+    if (mInstancing && instancingSupported()) {
+        findInstanceGroups(*mPending.data, kMaxInstances, mPending.instanceGroups);
+        size_t instanced = 0;
+        for (const std::vector<uint32_t> &group : mPending.instanceGroups) {
+            for (uint32_t node : group) {
+                mPending.instancedNodes[node] = 1;
+            }
+            instanced += group.size();
+        }
+        if (instanced > 0)
+            qInfo() << "Instancing " << instanced << " nodes in " << mPending.instanceGroups.size() << " renderables";
     }
-    createRenderables(scene, scene->mRootNode, aiMatrix4x4());
+}
+
+//------------------------------------------------------------------------------
+
+float FilamentRenderer::pendingSceneProgress() const
+{
+    if (!mPending.data)
+        return 0.0f;
+
+    const SceneData &data = *mPending.data;
+    size_t total = data.materials.size() + data.meshes.size() + data.nodes.size() +
+                   mPending.instanceGroups.size();
+    size_t done = mPending.nextMaterial + mPending.nextMesh + mPending.nextNode +
+                  mPending.nextGroup;
+    return total ? float(done) / total : 1.0f;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::cancelPendingScene()
+{
+    if (!mPending.data)
+        return;
+
+    // none of these were added to the scene yet.
+    cleanupRenderElements(mPending.res);
+    mPending.data.reset();
+}
+
+//------------------------------------------------------------------------------
+
+bool FilamentRenderer::processPendingScene(std::chrono::microseconds budget)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (!mPending.data)
+        return false;
+
+    SceneData &data = *mPending.data;
+    SceneResources &res = mPending.res;
+    const auto start = clock::now();
+
+    // Create at least one object per call so that a load always progresses,
+    // then keep going until the slice budget is used up.
+    auto budgetLeft = [&]() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start) < budget;
+    };
+
+    do {
+        if (mPending.nextMaterial < data.materials.size()) {
+            createMaterials(data.materials[mPending.nextMaterial++], res);
+        } else if (mPending.nextMesh < data.meshes.size()) {
+            createRenderMesh(std::move(data.meshes[mPending.nextMesh++]), res);
+        } else if (mPending.nextNode < data.nodes.size()) {
+            const size_t node_idx = mPending.nextNode++;
+            if (!mPending.instancedNodes[node_idx])
+                createRenderables(data, data.nodes[node_idx], res);
+        } else if (mPending.nextGroup < mPending.instanceGroups.size()) {
+            createInstancedRenderable(data, mPending.instanceGroups[mPending.nextGroup++], res);
+        } else if (mProgressiveStreaming ||
+                   (mUploads.pendingCount(res.generation) == 0 && res.textureBindings.empty())) {
+            swapPendingScene();
+            return true;
+        } else {
+            // everything is created, wait for the uploads to land.
+            return false;
+        }
+    } while (budgetLeft());
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::swapPendingScene()
+{
+    // retire the old scene and show the new one in the same frame.
+    cleanupRenderElements(mSceneRes);
+
+    mSceneRes = std::move(mPending.res);
+    mPending.res = SceneResources();
+    mPending.data.reset();
+
+    showReadyRenderables(mSceneRes);
 
     centerCamera();
+    mDirty = true;
+
+    size_t masked = 0;
+    for (const auto &entry : mSceneRes.uniqueInstances) {
+        masked += entry.second->getMaterial() == mMaskedMaterial ? 1 : 0;
+    }
+    qInfo() << "Material instances: " << mSceneRes.uniqueInstances.size() << " for "
+            << mSceneRes.materialInstances.size() << " materials, "
+            << mSceneRes.uniqueInstances.size() - masked << " opaque, " << masked << " masked";
+
+    TextureCache::Stats stats = mTextureCache.stats();
+    qInfo() << "Texture cache: " << stats.hits << " hits, " << stats.misses
+            << " misses, " << stats.entries << " textures";
+}
+
+//------------------------------------------------------------------------------
+
+FilamentRenderer::SceneResources* FilamentRenderer::resourcesFor(uint32_t generation)
+{
+    if (mSceneRes.generation == generation)
+        return &mSceneRes;
+    if (mPending.data && mPending.res.generation == generation)
+        return &mPending.res;
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::meshUploaded(uint32_t generation, uint32_t mesh_idx)
+{
+    SceneResources *res = resourcesFor(generation);
+    if (res && mesh_idx < res->renderMeshes.size()) {
+        RenderMesh &rm = res->renderMeshes[mesh_idx];
+        if (rm.pendingUploads > 0)
+            --rm.pendingUploads;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::textureUploaded(filament::Texture *tex)
+{
+    // the texture may be bound by both the current and the pending scene.
+    for (SceneResources *res : { &mSceneRes, &mPending.res }) {
+        auto bindings = res->textureBindings.find(tex);
+        if (bindings != res->textureBindings.end()) {
+            for (auto &binding : bindings->second) {
+                binding.first->setParameter(binding.second, tex, materialSampler());
+            }
+            res->textureBindings.erase(bindings);
+            mDirty |= res == &mSceneRes;
+        }
+    }
+
+    if (filament::Texture *placeholder = mTextureCache.uploaded(tex))
+        mEngine->destroy(placeholder);
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::showReadyRenderables(SceneResources &res)
+{
+    auto &hidden = res.hiddenRenderables;
+    auto it = std::remove_if(hidden.begin(), hidden.end(),
+                             [&](const SceneResources::HiddenRenderable &r) {
+                                 for (uint32_t mesh_idx : r.meshes) {
+                                     if (res.renderMeshes[mesh_idx].pendingUploads > 0)
+                                         return false;
+                                 }
+                                 res.ready[r.renderable] = 1;
+                                 return true;
+                             });
+    hidden.erase(it, hidden.end());
+
+    updateSceneMembership(res);
+}
+
+//------------------------------------------------------------------------------
+
+bool FilamentRenderer::instancingSupported()
+{
+#ifdef HAVE_FILAMENT_INSTANCING
+    return true;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::setFrustumCulling(bool enabled)
+{
+    mFrustumCulling = enabled;
+
+    auto &rcm = mEngine->getRenderableManager();
+    for (SceneResources *res : { &mSceneRes, &mPending.res }) {
+        for (utils::Entity e : res->renderables) {
+            rcm.setCulling(rcm.getInstance(e), enabled);
+        }
+    }
+    mDirty = true;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::buildCullHierarchy(SceneResources &res)
+{
+    using namespace filament;
+    auto &tcm = mEngine->getTransformManager();
+    auto &rcm = mEngine->getRenderableManager();
+
+    // Bounds relative to mRoot, so that rotating the model only changes the
+    // frustum the hierarchy is tested against.
+    const math::mat4f root_from_world = inverse(tcm.getWorldTransform(tcm.getInstance(mRoot)));
+    std::vector<Box> boxes;
+    boxes.reserve(res.renderables.size());
+    Box scene_bounds;
+    for (size_t i = 0; i < res.renderables.size(); ++i) {
+        utils::Entity e = res.renderables[i];
+        SceneResources::CullInfo &info = res.cullInfo[i];
+        info.rootTransform = root_from_world * tcm.getWorldTransform(tcm.getInstance(e));
+        info.bounds = rigidTransform(rcm.getAxisAlignedBoundingBox(rcm.getInstance(e)),
+                                     info.rootTransform);
+        boxes.push_back(info.bounds);
+        if (info.bounds.isEmpty())
+            continue;
+        if (scene_bounds.isEmpty())
+            scene_bounds = info.bounds;
+        else
+            scene_bounds.unionSelf(info.bounds);
+    }
+    res.bvh.build(boxes);
+    res.shadowReach = 2.0f * length(scene_bounds.halfExtent);
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::cullRenderables(SceneResources &res)
+{
+    using namespace filament;
+    auto &tcm = mEngine->getTransformManager();
+
+    const size_t count = res.renderables.size();
+    const math::mat4f clip_from_root =
+        math::mat4f(mMainCamera->getProjectionMatrix()) *
+        math::mat4f(mMainCamera->getViewMatrix()) *
+        tcm.getWorldTransform(tcm.getInstance(mRoot));
+    const CullFrustum frustum(clip_from_root);
+    if (!mFrustumCulling || res.bvh.size() != count) {
+        // not culling, or the scene is not current yet
+        res.visible.assign(count, 1);
+        mCullStats = Bvh::Stats();
+        mCullStats.visible = uint32_t(count);
+    } else {
+        mCullStats = res.bvh.cull(frustum, res.visible);
+    }
+
+    if (mOcclusionCulling && res.bvh.size() == count) {
+        cullOccluded(res, clip_from_root);
+    } else {
+        const std::chrono::microseconds draw_time = mOcclusionStats.drawTime;
+        mOcclusionStats = OcclusionStats();
+        mOcclusionStats.drawTime = draw_time;
+    }
+
+    mShadowCasters = 0;
+    if (res.bvh.size() == count)
+        keepShadowCasters(res, frustum);
+
+    updateSceneMembership(res);
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::keepShadowCasters(SceneResources &res, const CullFrustum &frustum)
+{
+    using namespace filament;
+    auto &tcm = mEngine->getTransformManager();
+
+    // Every renderable casts shadows, and the engine only draws the shadows
+    // of casters that are in the scene. A shadow falls somewhere in its
+    // caster's bounds swept along the sun by shadowReach, so a culled
+    // renderable stays in the scene while that swept box may still be seen.
+    const math::mat4f root_from_world = inverse(tcm.getWorldTransform(tcm.getInstance(mRoot)));
+    const math::float3 sweep =
+        normalize((root_from_world * math::float4(kSunDirection, 0.0f)).xyz) * res.shadowReach;
+    const bool occlusion = mOcclusionCulling && mOcclusionStats.occluders > 0;
+
+    uint32_t kept = 0;
+    for (size_t i = 0; i < res.renderables.size(); ++i) {
+        if (res.visible[i] || !res.ready[i])
+            continue;
+        const Box &bounds = res.cullInfo[i].bounds;
+        Box swept;
+        swept.set(min(bounds.getMin(), bounds.getMin() + sweep),
+                  max(bounds.getMax(), bounds.getMax() + sweep));
+        if (!frustum.intersects(swept))
+            continue;
+        if (occlusion && !mOcclusionCuller.isVisible(swept))
+            continue;
+        res.visible[i] = 1;
+        ++kept;
+    }
+    mShadowCasters = kept;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::cullOccluded(SceneResources &res, const filament::math::mat4f &clip_from_root)
+{
+    using namespace filament;
+    using clock = std::chrono::steady_clock;
+    auto &tcm = mEngine->getTransformManager();
+
+    const auto start = clock::now();
+    OcclusionStats stats;
+    stats.drawTime = mOcclusionStats.drawTime;
+
+    // the camera in mRoot's space, to rank occluders by their size on screen
+    const math::mat4f root_from_world = inverse(tcm.getWorldTransform(tcm.getInstance(mRoot)));
+    const math::float4 eye = root_from_world * math::float4(mCamManipulator.pos(), 1.0f);
+
+    struct Candidate {
+        uint32_t renderable;
+        float size;
+    };
+    std::vector<Candidate> candidates;
+    for (size_t i = 0; i < res.renderables.size(); ++i) {
+        if (!res.ready[i] || !res.visible[i])
+            continue;
+        const SceneResources::CullInfo &info = res.cullInfo[i];
+        if (info.instanced)
+            continue;
+        bool has_occluder = false;
+        for (uint32_t mesh_idx : info.meshes) {
+            has_occluder |= !res.renderMeshes[mesh_idx].occluder.empty();
+        }
+        if (!has_occluder)
+            continue;
+        const float radius = length(info.bounds.halfExtent);
+        const float dist = std::max(length(info.bounds.center - eye.xyz) - radius, 0.1f);
+        candidates.push_back({ uint32_t(i), radius / dist });
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.size > b.size;
+    });
+
+    mOcclusionCuller.begin(clip_from_root);
+    std::vector<uint8_t> is_occluder(res.renderables.size(), 0);
+    size_t triangles = 0;
+    for (const Candidate &candidate : candidates) {
+        if (stats.occluders >= kMaxOccluders || triangles >= kOccluderTriangleBudget)
+            break;
+        const SceneResources::CullInfo &info = res.cullInfo[candidate.renderable];
+        for (uint32_t mesh_idx : info.meshes) {
+            triangles += mOcclusionCuller.rasterize(res.renderMeshes[mesh_idx].occluder,
+                                                    info.rootTransform);
+        }
+        is_occluder[candidate.renderable] = 1;
+        ++stats.occluders;
+    }
+
+    if (stats.occluders > 0) {
+        for (size_t i = 0; i < res.renderables.size(); ++i) {
+            if (!res.visible[i] || is_occluder[i])
+                continue;
+            ++stats.tested;
+            if (!mOcclusionCuller.isVisible(res.cullInfo[i].bounds)) {
+                res.visible[i] = 0;
+                ++stats.occluded;
+                stats.occludedTriangles += res.cullInfo[i].triangles;
+            }
+        }
+    }
+
+    stats.cullTime = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+    if (mSubmittedTriangles > 0) {
+        stats.estimatedSavings = std::chrono::microseconds(
+            int64_t(double(stats.drawTime.count()) * stats.occludedTriangles / mSubmittedTriangles));
+    }
+    mOcclusionStats = stats;
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::updateSceneMembership(SceneResources &res)
+{
+    mSubmittedTriangles = 0;
+    for (size_t i = 0; i < res.renderables.size(); ++i) {
+        const uint8_t show = res.ready[i] && res.visible[i];
+        if (show)
+            mSubmittedTriangles += res.cullInfo[i].triangles;
+        if (show == res.inScene[i])
+            continue;
+        if (show)
+            mScene->addEntity(res.renderables[i]);
+        else
+            mScene->remove(res.renderables[i]);
+        res.inScene[i] = show;
+        mDirty = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void FilamentRenderer::selectLods(SceneResources &res)
+{
+    if (res.lodPrimitives.empty())
+        return;
+
+    auto &tcm = mEngine->getTransformManager();
+    auto &rcm = mEngine->getRenderableManager();
+
+    const math::float3 eye = mCamManipulator.pos();
+    const float viewport_height = float(mView->getViewport().height);
+    const float pixels_per_radian = viewport_height / float(2.0 * std::tan(mFOV * (M_PI / 360)));
+
+    for (SceneResources::LodPrimitive &prim : res.lodPrimitives) {
+        const RenderMesh &rm = res.renderMeshes[prim.mesh];
+        const math::mat4f world = tcm.getWorldTransform(tcm.getInstance(prim.entity));
+        const Box box = rigidTransform(rm.bounds, world);
+        const float radius = length(box.halfExtent);
+        const float dist = std::max(length(box.center - eye) - radius, 0.1f);
+
+        // LOD errors are relative to the bounding radius.
+        const float scale = radius / dist * pixels_per_radian;
+        auto pixelError = [&](uint32_t lod) { return rm.lods[lod].error * scale; };
+
+        uint32_t lod = prim.lod;
+        while (lod + 1 < rm.lods.size() && pixelError(lod + 1) <= mLodPixelError * kLodHysteresis)
+            ++lod;
+        while (lod > 0 && pixelError(lod) > mLodPixelError)
+            --lod;
+        if (lod == prim.lod)
+            continue;
+
+        prim.lod = lod;
+        rcm.setGeometryAt(rcm.getInstance(prim.entity), prim.primitive,
+                          RenderableManager::PrimitiveType::TRIANGLES,
+                          rm.lods[lod].offset, rm.lods[lod].count);
+        mDirty = true;
+    }
 }
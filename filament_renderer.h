@@ -4,25 +4,44 @@
 #include <QColor>
 #include <QImage>
 
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <unordered_map>
+#include <utility>
 
 #include <assimp/scene.h>
 
 #include <filament/Texture.h>
 #include <utils/Entity.h>
 #include <filament/Engine.h>
+#include <filament/Fence.h>
 #include <filament/IndexBuffer.h>
+#ifdef HAVE_FILAMENT_INSTANCING
+#include <filament/InstanceBuffer.h>
+#endif
 #include <filament/LightManager.h>
 #include <filament/Material.h>
 #include <filament/RenderableManager.h>
 #include <filament/TransformManager.h>
 #include <filament/Renderer.h>
+#include <filament/RenderTarget.h>
 #include <filament/Scene.h>
 #include <filament/VertexBuffer.h>
 #include <filament/View.h>
 #include <filament/Viewport.h>
 
+#include "bvh.h"
 #include "camera.h"
+#include "frame_pacer.h"
+#include "mesh_data.h"
+#include "occlusion_culler.h"
+#include "resolution_controller.h"
+#include "scene_data.h"
+#include "target_ring.h"
+#include "texture_cache.h"
+#include "upload_scheduler.h"
+#include "worker_pool.h"
 
 //------------------------------------------------------------------------------
 
@@ -33,31 +52,205 @@ public:
     // Explicitly defaulted virtual destructor
     virtual ~FilamentRenderer();
 
+    // Renders into the GL textures col_texture_ids, created in the shared
+    // context, one per slot of ring and width x height each, the largest a
+    // frame can be. Each frame takes a free slot and hands it to ring once
+    // its fence signals.
     void init(void* nativewindow, void *sharedContext,
-              int width, int height, unsigned int col_texture_id);
+              int width, int height, const std::vector<unsigned int> &col_texture_ids,
+              TargetRing *ring);
+
+    // Renders without a window, a GUI or a shared context, into an
+    // off-screen swap chain of width x height that renderImage() reads
+    // back. The NOOP backend does everything but the GPU work. Returns false
+    // if the backend has no platform to run on; on Linux, OPENGL needs an X
+    // display (Xvfb will do) unless Filament was built for headless EGL.
+    // The renderer can only be destroyed after a failure.
+    bool initHeadless(filament::Engine::Backend backend, uint32_t width, uint32_t height);
 
     void resetRootTransform();
+    void setRootTransform(const filament::math::mat4f &transform);
 
+    // Converts and uploads scene in one go, blocking the calling thread.
     void setScene(const aiScene *scene, std::string filename);
 
+    // Creates and uploads an already converted scene in one go, blocking the
+    // calling thread until the engine has copied all of it. The camera is
+    // centered on it.
+    void setSceneDataNow(std::unique_ptr<SceneData> data);
+
+    // Draws a frame and reads it back into image, blocking until the GPU is
+    // done. Only for renderers set up with initHeadless(); returns false if
+    // nothing could be read back. The NOOP backend draws but never reads
+    // anything back.
+    bool renderImage(QImage &image);
+
+    // Starts uploading an already converted scene. Engine objects are created
+    // in bounded slices at the start of each draw() and the new scene replaces
+    // the current one only once it is complete. A scene that is still being
+    // uploaded is cancelled.
+    void setSceneData(std::unique_ptr<SceneData> data);
+
+    bool hasPendingScene() const { return mPending.data != nullptr; }
+
+    // Fraction of the pending scene's engine objects created so far.
+    float pendingSceneProgress() const;
+
+    // Drops the pending scene; the current scene keeps rendering.
+    void cancelPendingScene();
+
+    // Maximum time spent creating engine objects for a pending scene per draw().
+    void setUploadSliceBudget(std::chrono::microseconds budget) { mUploadSliceBudget = budget; }
+
+    // Limits the vertex, index and texture data submitted to the engine per
+    // draw(). Anything over budget stays queued for the following frames.
+    void setUploadBudget(size_t bytes, std::chrono::microseconds time) {
+        mUploadByteBudget = bytes;
+        mUploadTimeBudget = time;
+    }
+
+    // When enabled (the default) a new scene replaces the current one as soon
+    // as its engine objects exist, and renderables appear as their data lands.
+    // Otherwise the current scene stays up until every upload is done.
+    void setProgressiveStreaming(bool enabled) { mProgressiveStreaming = enabled; }
+
+    const UploadScheduler::Stats& uploadStats() const { return mUploads.stats(); }
+
+    // Hits and misses of the shared material texture cache.
+    TextureCache::Stats textureCacheStats() const { return mTextureCache.stats(); }
+
+    // Uploads textures block compressed when the engine supports it (the
+    // default). Takes effect for scenes built after the call.
+    void setTextureCompression(bool enabled) { mTextureCompression = enabled; }
+
+    // True once init() has found the compressed formats supported.
+    bool compressedTexturesSupported() const { return mCompressedTexturesSupported; }
+
+    // Vertex layout of scenes built after the call. COMPACT (the default)
+    // uses about half the memory and bandwidth of FLOAT, which keeps full
+    // precision.
+    void setVertexFormat(VertexFormat format) { mVertexFormat = format; }
+
+    // Merges small static meshes that share a material into batches drawn by
+    // one renderable each, for scenes built after the call. Off by default.
+    void setStaticBatching(bool enabled) { mStaticBatching = enabled; }
+
+    // Screen space error in pixels a LOD may have before a finer one is
+    // drawn instead.
+    void setLodPixelError(float pixels) { mLodPixelError = pixels; }
+
+    // Culls renderables against the view frustum (the default), first whole
+    // groups of them with a hierarchy over their bounds, then one by one in
+    // the engine.
+    void setFrustumCulling(bool enabled);
+
+    // Draws nodes that draw the same meshes as instances of one renderable per
+    // group of up to kMaxInstances nearby nodes (the default). Only meshes
+    // without LODs are instanced, since all instances draw the same level. Takes
+    // effect for scenes set after the call; does nothing unless Filament
+    // supports instancing.
+    static const size_t kMaxInstances = 64; // Filament's per-buffer limit
+    void setInstancing(bool enabled) { mInstancing = enabled; }
+    static bool instancingSupported();
+
+    // Renderables that passed and failed the last draw()'s cull.
+    const Bvh::Stats& cullStats() const { return mCullStats; }
+
+    // Renderables the last cull kept in the scene only because their
+    // shadows may be seen.
+    uint32_t shadowCasterCount() const { return mShadowCasters; }
+
+    // Also culls renderables hidden behind others, see OcclusionCuller. Off
+    // by default; takes effect for scenes created after the call, which keep
+    // coarse occluder geometry on the CPU.
+    void setOcclusionCulling(bool enabled) { mOcclusionCulling = enabled; }
+
+    struct OcclusionStats {
+        uint32_t occluders = 0;
+        uint32_t tested = 0;
+        uint32_t occluded = 0;
+        uint64_t occludedTriangles = 0;
+        std::chrono::microseconds cullTime{0};
+        // CPU time of the previous frame's render() and endFrame(), and the
+        // share of it the occluded triangles would have taken
+        std::chrono::microseconds drawTime{0};
+        std::chrono::microseconds estimatedSavings{0};
+    };
+    const OcclusionStats& occlusionStats() const { return mOcclusionStats; }
+
+    // Options for buildSceneData() and SceneLoader::load() that match what
+    // this renderer can upload.
+    SceneBuildOptions sceneBuildOptions() const;
+
+    // Draws a frame now. Never waits for the engine: if it is still busy
+    // with earlier frames, this one is skipped. Does nothing on a renderer
+    // set up with initHeadless(), which draws with renderImage().
     virtual void draw();
 
+    // Draws a frame if one is due at the target frame rate, see FramePacer.
+    // Returns false if it was not due or was skipped; call again after
+    // timeUntilNextFrame(). A due frame is only drawn if the camera, the
+    // root transform, the size or what the scene shows changed since the
+    // last one; otherwise the GUI keeps showing the last texture and the
+    // frame counts as idle in frameStats(). Does nothing on a headless
+    // renderer.
+    bool tryDraw();
+
+    // Draws the next due frame even if nothing changed.
+    void requestRedraw() { mDirty = true; }
+
+    // False while there is nothing to draw, upload or hand over, so the
+    // caller may sleep until it changes something.
+    bool needsFrame() const;
+    std::chrono::microseconds timeUntilNextFrame() const {
+        return mFramePacer.timeUntilNextFrame(FramePacer::Clock::now());
+    }
+
+    // 0 leaves the rate to the caller. 60 by default. The frame time the
+    // resolution scale aims for follows it.
+    void setTargetFrameRate(double fps);
+    FramePacer::Stats frameStats() const { return mFramePacer.stats(); }
+
+    // True while drawn frames wait for their fence.
+    bool framesInFlight() const { return !mPendingTargets.empty(); }
+
+    // Size of the view in pixels. Frames cover a fraction of it, see
+    // setResolutionScaleRange(), and never more than the targets hold.
     virtual void resize(uint32_t w, uint32_t h);
 
+    // Frames are drawn at a fraction of the view's size in this range that
+    // keeps them to the target frame time, see ResolutionController. Once
+    // nothing changes any more, one last frame is drawn at max_scale. Equal
+    // bounds fix the scale; 0.5 to 1 by default.
+    void setResolutionScaleRange(float min_scale, float max_scale);
+    float resolutionScale() const { return mResolution.scale(); }
+
     void set_projection(uint32_t w, uint32_t h);
 
+    // Number of threads used for CPU-side scene conversion. 0 uses all cores,
+    // 1 converts serially on the calling thread.
+    void setNumThreads(unsigned num_threads);
+
 private:
     float mFOV = 30.f;
+    float mAspect = 1.0f;
+    float mFar = 10.0f; // grows with the scene so the engine does not cull it
 
     float mZDist = 1.0f;
     float mRotX = 0.0f;
     float mRotY = 0.0f;
 
     struct RenderMesh {
-        filament::VertexBuffer *vb;
-        filament::IndexBuffer *ib;
-        filament::Box aabb;
-        uint32_t indexCount;
+        filament::VertexBuffer *vb = nullptr;
+        filament::IndexBuffer *ib = nullptr;
+        filament::Box aabb;                  // in the mesh's space
+        filament::Box bounds;                // of the vertices as uploaded
+        filament::math::mat4f dequantization; // from uploaded to mesh space
+        uint32_t indexCount = 0;
+        std::vector<MeshData::Lod> lods;     // ranges of ib, empty for one level
+        OccluderMesh occluder;               // in the uploaded space
+        std::vector<MeshData::BatchSource> sources; // of a static batch
+        uint32_t pendingUploads = 0;
     };
 
     struct MatTextures {
@@ -69,7 +262,80 @@ private:
         filament::Texture *maskMap = nullptr;
     };
 
-    const aiScene *mAiScene = nullptr;
+    // Engine objects that make up one loaded scene.
+    struct SceneResources {
+        uint32_t generation = 0; // tags this scene's queued uploads
+        std::vector<MatTextures> textures;
+        // indexed like SceneData::materials, identical materials share one
+        std::vector<filament::MaterialInstance*> materialInstances;
+        // owns the instances, by materialKey()
+        std::unordered_map<std::string, filament::MaterialInstance*> uniqueInstances;
+        std::vector<RenderMesh> renderMeshes; // indexed like SceneData::meshes
+        std::vector<utils::Entity> renderables;
+
+        // renderables whose data has not all been uploaded yet, with the
+        // meshes they wait on
+        struct HiddenRenderable {
+            uint32_t renderable;
+            std::vector<uint32_t> meshes;
+        };
+        std::vector<HiddenRenderable> hiddenRenderables;
+
+        // A renderable is in the scene while it is ready and visible.
+        // All three are indexed like renderables.
+        std::vector<uint8_t> ready;
+        std::vector<uint8_t> visible;   // as of the last cull
+        std::vector<uint8_t> inScene;
+
+        // where each renderable is relative to mRoot, indexed like renderables
+        struct CullInfo {
+            filament::Box bounds;
+            filament::math::mat4f rootTransform;
+            std::vector<uint32_t> meshes;
+            uint32_t triangles = 0;
+            bool instanced = false; // rootTransform only places the group
+        };
+        std::vector<CullInfo> cullInfo;
+
+        // hierarchy over the cullInfo bounds
+        Bvh bvh;
+        // farthest a shadow can fall from its caster, the length of the
+        // diagonal of all the bounds
+        float shadowReach = 0.0f;
+
+#ifdef HAVE_FILAMENT_INSTANCING
+        std::vector<filament::InstanceBuffer*> instanceBuffers;
+#endif
+
+        // primitives drawing meshes with LODs, and the level they draw
+        struct LodPrimitive {
+            utils::Entity entity;
+            uint32_t primitive;
+            uint32_t mesh;
+            uint32_t lod;
+        };
+        std::vector<LodPrimitive> lodPrimitives;
+
+        // material parameters bound to a placeholder, to rebind once the
+        // texture's full image has been uploaded
+        std::unordered_map<filament::Texture*,
+                           std::vector<std::pair<filament::MaterialInstance*, const char*>>> textureBindings;
+    };
+
+    // A scene whose engine objects are being created across several frames.
+    struct PendingScene {
+        std::unique_ptr<SceneData> data;
+        SceneResources res;
+        size_t nextMaterial = 0;
+        size_t nextMesh = 0;
+        size_t nextNode = 0;
+
+        // nodes drawn as instances, grouped by mesh and proximity; the
+        // other nodes get a renderable each
+        std::vector<std::vector<uint32_t>> instanceGroups;
+        std::vector<uint8_t> instancedNodes;
+        size_t nextGroup = 0;
+    };
 
     filament::Engine* mEngine = nullptr;
     filament::SwapChain* mSwapChain = nullptr;
@@ -77,37 +343,150 @@ private:
     filament::Camera* mMainCamera = nullptr;
     filament::Scene* mScene = nullptr;
     filament::View* mView = nullptr;
-    filament::Texture *mRenderTexture = nullptr;
+
+    // One per TargetRing slot.
+    struct FrameTarget {
+        filament::Texture *color = nullptr; // imported from the shared context
+        filament::Texture *depth = nullptr;
+        filament::RenderTarget *target = nullptr;
+        filament::Fence *fence = nullptr;   // while the slot is PENDING
+        FramePacer::Clock::time_point started;
+        bool timed = false; // feeds the resolution scale
+    };
+    std::vector<FrameTarget> mTargets;
+    std::deque<int> mPendingTargets; // slots with a fence, oldest first
+    TargetRing *mTargetRing = nullptr;
+    uint32_t mTargetWidth = 0;
+    uint32_t mTargetHeight = 0;
+    uint32_t mViewWidth = 0;
+    uint32_t mViewHeight = 0;
+    ResolutionController mResolution;
+    float mDrawnScale = 0.0f; // of the last frame
     utils::Entity mLight;
 
     utils::Entity mRoot;
     utils::Entity mCenterNode; // holds xform to move geo to origin
 
-    filament::Material *mMaterial = nullptr;
+    filament::Material *mOpaqueMaterial = nullptr; // bakedTextureLit
+    filament::Material *mMaskedMaterial = nullptr; // transparent
 
     CameraManipulator mCamManipulator;
 
-    std::vector<MatTextures> mTextures;
-    std::vector<filament::MaterialInstance*> mMaterialInstances;
-    std::vector<RenderMesh> mRenderMeshes;
-    std::vector<utils::Entity> mRenderables;
-
-    void createRenderMesh(const aiScene *scene, aiMesh const *mesh);
-    void createRenderables(const aiScene *scene,
-                           aiNode const *node,
-                           aiMatrix4x4 transform);
-    void createMaterials(const aiScene *scene, const aiMaterial *mat,
-                         const std::string &basedir);
-    QImage createOneByOneImage(QImage::Format format, const QColor &color);
-    filament::Texture* createTexture(QString img_path,
-                                     QColor default_color,
-                                     QImage::Format format,
-                                     filament::Texture::InternalFormat tex_format);
+    unsigned mNumThreads = 0;
+    std::unique_ptr<WorkerPool> mWorkerPool;
+
+    SceneResources mSceneRes;
+    PendingScene mPending;
+    std::chrono::microseconds mUploadSliceBudget{4000};
+
+    UploadScheduler mUploads;
+    uint32_t mGeneration = 0;
+    uint32_t mNextTextureUploadTag = 0x80000000u; // above scene generations
+
+    TextureCache mTextureCache;
+    size_t mUploadByteBudget = 16 * 1024 * 1024;
+    std::chrono::microseconds mUploadTimeBudget{4000};
+    bool mProgressiveStreaming = true;
+
+    bool mTextureCompression = true;
+    VertexFormat mVertexFormat = VertexFormat::COMPACT;
+    bool mStaticBatching = false;
+    float mLodPixelError = 1.0f;
+    bool mFrustumCulling = true;
+    bool mInstancing = true;
+    Bvh::Stats mCullStats;
+    uint32_t mShadowCasters = 0;
+    bool mOcclusionCulling = false;
+    OcclusionCuller mOcclusionCuller;
+    OcclusionStats mOcclusionStats;
+    uint64_t mSubmittedTriangles = 0; // by the renderables in the scene
+    bool mCompressedTexturesSupported = false;
+    bool mHeadless = false; // draws into mSwapChain, see renderImage()
+    filament::Engine::Backend mBackend = filament::Engine::Backend::OPENGL;
+    FramePacer mFramePacer;
+    bool mDirty = true; // something besides the camera changed since the last frame
+
+    // Off-screen draws that compile each material before the first scene,
+    // one per frame, see stepWarmUp(). Null once done.
+    struct WarmUp {
+        filament::VertexBuffer *vb = nullptr;
+        filament::IndexBuffer *ib = nullptr;
+        filament::Texture *texture = nullptr;
+        filament::Texture *color = nullptr;
+        filament::RenderTarget *target = nullptr;
+        filament::Scene *scene = nullptr;
+        filament::Camera *camera = nullptr;
+        filament::View *view = nullptr;
+        std::vector<std::pair<const char*, filament::Material*>> materials;
+        size_t next = 0; // material being drawn
+        filament::MaterialInstance *instance = nullptr;
+        utils::Entity renderable;
+        filament::Fence *fence = nullptr; // once next has been drawn
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point materialStart;
+    };
+    std::unique_ptr<WarmUp> mWarmUp;
+
+    WorkerPool& workerPool();
+
+    void initScene(int width, int height);
+
+    // Headless only: begins a frame, waiting for the GPU between at most
+    // kMaxBeginFrameTries tries.
+    static const int kMaxBeginFrameTries = 4;
+    bool beginHeadlessFrame();
+
+    bool drawFrame();
+    void pollTargets();
+
+    bool processPendingScene(std::chrono::microseconds budget);
+    void swapPendingScene();
+
+    SceneResources* resourcesFor(uint32_t generation);
+    void meshUploaded(uint32_t generation, uint32_t mesh_idx);
+    void textureUploaded(filament::Texture *tex);
+    void showReadyRenderables(SceneResources &res);
+    void buildCullHierarchy(SceneResources &res);
+    void cullRenderables(SceneResources &res);
+    void cullOccluded(SceneResources &res, const filament::math::mat4f &clip_from_root);
+    void keepShadowCasters(SceneResources &res, const CullFrustum &frustum);
+    void updateSceneMembership(SceneResources &res);
+    void selectLods(SceneResources &res);
+
+    void createRenderMesh(MeshData &&data, SceneResources &res);
+    void createRenderables(const SceneData &scene, const NodeData &node,
+                           SceneResources &res);
+    void createInstancedRenderable(const SceneData &scene, const std::vector<uint32_t> &nodes,
+                                   SceneResources &res);
+    bool renderableParts(const SceneData &scene, size_t src_idx, const SceneResources &res,
+                         std::vector<uint32_t> &parts);
+    void renderableGroups(const SceneData &scene, const std::vector<uint32_t> &meshes,
+                          const SceneResources &res, std::vector<std::vector<uint32_t>> &groups);
+    void addRenderable(const SceneData &scene, const std::vector<uint32_t> &parts,
+                       const std::string &name, const filament::math::mat4f &transform,
+                       const std::vector<filament::math::mat4f> *instances,
+                       SceneResources &res);
+    // Warm-up draws one material per stepWarmUp() and polls its fence; the
+    // step returns true while materials are left. finishWarmUp() steps
+    // through all of them for a headless renderer, waiting on the GPU a
+    // bounded number of times.
+    void startWarmUp();
+    bool stepWarmUp();
+    void finishWarmUp();
+    void releaseWarmUpInstance();
+    void endWarmUp();
+    void createMaterials(const MaterialData &mat, SceneResources &res);
+    filament::Texture* createTexture(const TextureSource &src);
+    filament::Texture* uploadTexture(const TextureSource &src);
+    filament::Texture* uploadCompressedTexture(const TextureSource &src);
+    void releaseTexture(filament::Texture *tex);
+    void bindTexture(SceneResources &res, filament::MaterialInstance *mat_inst,
+                     const char *param, filament::Texture *tex);
     void centerCamera();
 
-    void cleanupTextures();
-    void cleanupMaterials();
-    void cleanupRenderMeshes();
-    void cleanupRenderables();
-    void cleanupRenderElements();
+    void cleanupTextures(SceneResources &res);
+    void cleanupMaterials(SceneResources &res);
+    void cleanupRenderMeshes(SceneResources &res);
+    void cleanupRenderables(SceneResources &res);
+    void cleanupRenderElements(SceneResources &res);
 };
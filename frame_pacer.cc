@@ -0,0 +1,90 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+
+constexpr std::chrono::microseconds FramePacer::kSlack;
+
+//------------------------------------------------------------------------------
+
+void FramePacer::setTargetFrameRate(double fps)
+{
+    mFrameRate = std::max(fps, 0.0);
+    mPeriod = mFrameRate > 0.0 ? std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / mFrameRate)) : Clock::duration::zero();
+    // the new rate applies from the last frame on.
+    mNextFrame = mLastFrame + mPeriod;
+}
+
+//------------------------------------------------------------------------------
+
+bool FramePacer::frameDue(Clock::time_point now) const
+{
+    return now + kSlack >= mNextFrame;
+}
+
+//------------------------------------------------------------------------------
+
+std::chrono::microseconds FramePacer::timeUntilNextFrame(Clock::time_point now) const
+{
+    if (frameDue(now))
+        return std::chrono::microseconds(0);
+    return std::chrono::duration_cast<std::chrono::microseconds>(mNextFrame - now);
+}
+
+//------------------------------------------------------------------------------
+
+void FramePacer::framePresented(Clock::time_point now)
+{
+    if (mPresented > 0 && !mResumed) {
+        const auto interval = std::chrono::duration_cast<std::chrono::microseconds>(now - mLastFrame);
+        if (mIntervals.size() < kHistorySize)
+            mIntervals.push_back(interval);
+        else
+            mIntervals[mNextInterval] = interval;
+        mNextInterval = (mNextInterval + 1) % kHistorySize;
+    }
+    ++mPresented;
+    mLastFrame = now;
+    mResumed = false;
+    schedule(now);
+}
+
+//------------------------------------------------------------------------------
+
+void FramePacer::frameIdle(Clock::time_point now)
+{
+    ++mIdle;
+    mResumed = true;
+    schedule(now);
+}
+
+//------------------------------------------------------------------------------
+
+void FramePacer::schedule(Clock::time_point now)
+{
+    // stay on the cadence, but drop the slots that were missed.
+    mNextFrame += mPeriod;
+    if (mNextFrame + kSlack < now)
+        mNextFrame = now + mPeriod;
+}
+
+//------------------------------------------------------------------------------
+
+FramePacer::Stats FramePacer::stats() const
+{
+    Stats stats;
+    stats.presented = mPresented;
+    stats.skipped = mSkipped;
+    stats.idle = mIdle;
+    if (mIntervals.empty())
+        return stats;
+
+    std::vector<std::chrono::microseconds> sorted = mIntervals;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](size_t p) { return sorted[(sorted.size() - 1) * p / 100]; };
+    stats.p50 = percentile(50);
+    stats.p90 = percentile(90);
+    stats.p99 = percentile(99);
+    stats.max = sorted.back();
+    return stats;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// Decides when the next frame is due for a target frame rate and keeps the
+// recent frame times. Frames are due on a fixed cadence; when a frame comes
+// late the missed slots are dropped rather than drawn back to back, so a
+// slow frame does not cause a burst of catch-up frames. Nothing here waits,
+// the caller asks when the next frame is due and comes back then.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Most recent frames the percentiles are taken over.
+    static const size_t kHistorySize = 240;
+
+    struct Stats {
+        uint64_t presented = 0;   // frames drawn since creation
+        uint64_t skipped = 0;     // due but dropped because the engine was behind
+        uint64_t idle = 0;        // due but not drawn because nothing changed
+        // of the intervals between the last kHistorySize presented frames
+        std::chrono::microseconds p50{0};
+        std::chrono::microseconds p90{0};
+        std::chrono::microseconds p99{0};
+        std::chrono::microseconds max{0};
+    };
+
+    // 0 draws a frame whenever one is asked for.
+    void setTargetFrameRate(double fps);
+    double targetFrameRate() const { return mFrameRate; }
+
+    // True if a frame should be drawn at now.
+    bool frameDue(Clock::time_point now) const;
+
+    // How long until the next frame is due, zero if it already is.
+    std::chrono::microseconds timeUntilNextFrame(Clock::time_point now) const;
+
+    // Records a frame drawn at now and schedules the next one.
+    void framePresented(Clock::time_point now);
+
+    // Records a due frame that was not drawn. The next try is not delayed.
+    void frameSkipped() { ++mSkipped; }
+
+    // Records a due frame that was not needed and schedules the next one.
+    // The time spent idle does not count as a frame interval.
+    void frameIdle(Clock::time_point now);
+
+    uint64_t presented() const { return mPresented; }
+
+    // Sorts the history, meant for reports rather than every frame.
+    Stats stats() const;
+
+private:
+    // Frames due this close are drawn now, timers rarely fire to the tick.
+    static constexpr std::chrono::microseconds kSlack{1000};
+
+    void schedule(Clock::time_point now);
+
+    double mFrameRate = 60.0;
+    Clock::duration mPeriod = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / 60.0));
+    Clock::time_point mNextFrame;
+    Clock::time_point mLastFrame;
+    std::vector<std::chrono::microseconds> mIntervals; // ring of kHistorySize
+    size_t mNextInterval = 0;
+    uint64_t mPresented = 0;
+    uint64_t mSkipped = 0;
+    uint64_t mIdle = 0;
+    bool mResumed = false; // the next presented frame follows an idle one
+};
@@ -2,15 +2,21 @@
 #include <QtDebug>
 #include <QOpenGLWidget>
 #include <QGraphicsView>
-#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
 #include <QApplication>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
+#include <QGraphicsTextItem>
+#include <QScreen>
+#include <QShortcut>
+#include <QTimer>
+#include <QVector2D>
+
+#include <algorithm>
+#include <cmath>
 
-#include <assimp/Importer.hpp>
 #include <assimp/scene.h>
-#include <assimp/postprocess.h>
 
 #include <filament/Texture.h>
 #include <utils/Entity.h>
@@ -29,76 +35,193 @@
 #include <filament/Fence.h>
 
 #include "filament_renderer.h"
+#include "render_thread.h"
+#include "scene_loader.h"
 #include "CocoaGLContext.h"
 //------------------------------------------------------------------------------
 
-class RenderWidget : public QOpenGLWidget, protected QOpenGLFunctions
+class RenderWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 {
 public:
     RenderWidget() : QOpenGLWidget()
     {
+        // poll the background loader and report upload progress.
+        m_load_timer.setInterval(16);
+        QObject::connect(&m_load_timer, &QTimer::timeout, [this]() { pollLoad(); });
     }
 
     virtual ~RenderWidget() {
-        delete m_filament_renderer;
+        m_load_timer.stop();
+        m_loader.cancel();
+
+        m_render_thread.stop();
+
+        makeCurrent();
+        for (GLsync fence : m_fences) {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        glDeleteTextures(GLsizei(kNumTargets), m_col_texture_ids);
+        doneCurrent();
 
         delete m_program;
     }
 
+    // Loads pFile on a background thread. The current scene keeps rendering
+    // until the new one is ready.
     void loadFile(const std::string &pFile)
     {
-        using namespace Assimp;
-        // Create an instance of the Importer class
-        mImporter = std::make_unique<Importer>();
-
-        // And have it read the given file with some example postprocessing
-        // Usually - if speed is not the most important aspect for you - you'll
-        // probably to request more postprocessing than we do in this example.
-        const aiScene* scene = mImporter->ReadFile( pFile,
-                                                    aiProcess_CalcTangentSpace       |
-                                                    aiProcess_Triangulate            |
-                                                    aiProcess_JoinIdenticalVertices  |
-                                                    aiProcess_FixInfacingNormals     |
-                                                    aiProcess_SortByPType);
-
-        // If the import failed, report it
-        if( !scene)
-        {
-            qInfo() << "Failed to load scene";
+        if (!m_render_thread.running()) {
+            // the build options depend on the renderer, start once it exists.
+            m_deferred_file = pFile;
+            setStatus("Loading " + QString::fromStdString(pFile));
             return;
         }
-        qInfo() << "Loaded scene successfully";
+        m_render_thread.cancelPendingScene();
 
-        qInfo() << "Num meshes: " << scene->mNumMeshes;
-
-        m_filament_renderer->setScene(scene, pFile);
+        m_loader.load(pFile, m_render_thread.status().buildOptions);
+        m_load_timer.start();
+        setStatus("Loading " + QString::fromStdString(pFile));
     }
 
-    void renderFilament()
+    void cancelLoad()
     {
-        m_filament_renderer->draw();
+        m_deferred_file.clear();
+        if (!m_load_timer.isActive())
+            return;
+
+        m_loader.cancel();
+        if (m_loader.state() != SceneLoader::State::LOADING) {
+            // the import already finished, drop the partial upload instead.
+            if (m_render_thread.running())
+                m_render_thread.cancelPendingScene();
+            setStatus("Loading cancelled");
+            m_load_timer.stop();
+        }
     }
 
+    // Text item used to report load progress.
+    void setStatusItem(QGraphicsTextItem *item) { m_status_item = item; }
+
     void renderFilamentTexture()
     {
         makeCurrent();
 
+        if (m_render_thread.running())
+            pickUpFrame();
+
         glClearColor(0.25, 0.25, 0.25, 1.0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         m_program->bind();
         m_program->setUniformValue("screenTexture", (int)0);
         m_object.bind();
-        glBindTexture(GL_TEXTURE_2D, m_col_texture_id);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        if (m_sampled >= 0) {
+            // the frame covers the lower left of the texture, stretch that
+            // over the quad without reaching past its last texels.
+            TargetRing &ring = m_render_thread.targets();
+            const float w = float(ring.width(m_sampled));
+            const float h = float(ring.height(m_sampled));
+            m_program->setUniformValue("uvScale", QVector2D(w / m_target_width, h / m_target_height));
+            m_program->setUniformValue("uvMax", QVector2D((w - 0.5f) / m_target_width,
+                                                          (h - 0.5f) / m_target_height));
+            glBindTexture(GL_TEXTURE_2D, m_col_texture_ids[m_sampled]);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
         m_object.release();
 
         m_program->release();
 
+        // the renderer may only draw into the texture again once this draw
+        // is done reading it.
+        if (m_sampled >= 0) {
+            if (m_fences[m_sampled])
+                glDeleteSync(m_fences[m_sampled]);
+            m_fences[m_sampled] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+
         doneCurrent();
     }
 
 protected:
+    // Switches to the newest frame the renderer finished, if there is one,
+    // and hands back textures the GPU is done sampling. Fences are polled,
+    // never waited on.
+    void pickUpFrame()
+    {
+        TargetRing &ring = m_render_thread.targets();
+        for (size_t i = 0; i < ring.size(); ++i) {
+            if (ring.state(i) != TargetRing::State::RETIRING)
+                continue;
+            if (m_fences[i]) {
+                const GLenum result = glClientWaitSync(m_fences[i], 0, 0);
+                if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                    continue;
+                glDeleteSync(m_fences[i]);
+                m_fences[i] = nullptr;
+            }
+            ring.release(int(i));
+        }
+
+        const int latest = ring.acquireLatest();
+        if (latest < 0)
+            return;
+        if (m_sampled >= 0)
+            ring.retire(m_sampled);
+        m_sampled = latest;
+    }
+
+    void setStatus(const QString &text)
+    {
+        if (m_status_item)
+            m_status_item->setPlainText(text);
+    }
+
+    void pollLoad()
+    {
+        // wait for the renderer before handing anything over.
+        if (!m_render_thread.running())
+            return;
+
+        switch (m_loader.state()) {
+        case SceneLoader::State::LOADING:
+            setStatus(QString("Importing: %1%").arg(int(m_loader.progress() * 100)));
+            return;
+        case SceneLoader::State::READY:
+            m_render_thread.setSceneData(m_loader.takeScene());
+            break;
+        case SceneLoader::State::FAILED:
+            setStatus("Failed to load scene");
+            m_load_timer.stop();
+            return;
+        case SceneLoader::State::CANCELLED:
+            setStatus("Loading cancelled");
+            m_load_timer.stop();
+            return;
+        case SceneLoader::State::IDLE:
+            break;
+        }
+
+        if (m_render_thread.hasPendingScene()) {
+            setStatus(QString("Uploading: %1%")
+                      .arg(int(m_render_thread.status().pendingProgress * 100)));
+        } else {
+            setStatus("");
+            m_load_timer.stop();
+        }
+    }
+
+    // Publishes the size of the quad frames are composited on, in pixels.
+    void setViewSize(int w, int h)
+    {
+        const qreal dpr = devicePixelRatioF();
+        RenderThread::ViewState state = m_render_thread.viewState();
+        state.width = uint32_t(std::max(std::lround(w * dpr * kQuadSize), 1L));
+        state.height = uint32_t(std::max(std::lround(h * dpr * kQuadSize), 1L));
+        m_render_thread.setViewState(state);
+    }
+
     void initializeGL() override {
         QOpenGLWidget::initializeGL();
         initializeOpenGLFunctions();
@@ -107,13 +230,13 @@ protected:
 
         float quadVertices[] = { // vertex attributes for a quad that fills the entire screen in Normalized Device Coordinates.
             // positions   // texCoords
-            -0.5f,  0.5f,  0.0f, 1.0f,
-            -0.5f, -0.5f,  0.0f, 0.0f,
-            0.5f, -0.5f,  1.0f, 0.0f,
+            -kQuadSize,  kQuadSize,  0.0f, 1.0f,
+            -kQuadSize, -kQuadSize,  0.0f, 0.0f,
+            kQuadSize, -kQuadSize,  1.0f, 0.0f,
 
-            -0.5f,  0.5f,  0.0f, 1.0f,
-            0.5f, -0.5f,  1.0f, 0.0f,
-            0.5f,  0.5f,  1.0f, 1.0f
+            -kQuadSize,  kQuadSize,  0.0f, 1.0f,
+            kQuadSize, -kQuadSize,  1.0f, 0.0f,
+            kQuadSize,  kQuadSize,  1.0f, 1.0f
         };
 
         if (!m_program)
@@ -124,9 +247,10 @@ protected:
                                                        layout (location = 0) in vec2 aPos;
                                                        layout (location = 1) in vec2 aTexCoords;
                                                        out vec2 TexCoords;
+                                                       uniform vec2 uvScale;
                                                        void main()
                                                        {
-                                                           TexCoords = aTexCoords;
+                                                           TexCoords = aTexCoords * uvScale;
                                                            gl_Position = vec4(aPos.x, aPos.y, 0.0, 1.0);
                                                        })SHADER");
             m_program->addShaderFromSourceCode(QOpenGLShader::Fragment,
@@ -134,9 +258,10 @@ protected:
                                                        out vec4 FragColor;
                                                        in vec2 TexCoords;
                                                        uniform sampler2D screenTexture;
+                                                       uniform vec2 uvMax;
                                                        void main()
                                                        {
-                                                           vec3 col = texture(screenTexture, TexCoords).rgb;
+                                                           vec3 col = texture(screenTexture, min(TexCoords, uvMax)).rgb;
                                                            FragColor = vec4(col, 1.0);
                                                        })SHADER");
 
@@ -163,17 +288,27 @@ protected:
             m_program->release();
         }
 
-        if (!m_filament_renderer) {
-            void *nativewindow = reinterpret_cast<void*>(winId());
-
-            int render_dim = 256;
-
-            // create texture for render target in qt's opengl context
-            glGenTextures(1, &m_col_texture_id);
-            glBindTexture(GL_TEXTURE_2D, m_col_texture_id);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, render_dim, render_dim, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (!m_render_thread.running()) {
+            // the quad never gets larger than on the largest screen, so the
+            // targets are allocated that large once and frames of any size
+            // up to it are drawn into their lower left corner.
+            QSize screen_size(1, 1);
+            for (QScreen *screen : QGuiApplication::screens()) {
+                const QSize size = screen->size() * screen->devicePixelRatio() * kQuadSize;
+                screen_size = screen_size.expandedTo(size);
+            }
+            m_target_width = screen_size.width();
+            m_target_height = screen_size.height();
+
+            // create the render target textures in qt's opengl context, the
+            // renderer draws into one while this side samples another.
+            glGenTextures(GLsizei(kNumTargets), m_col_texture_ids);
+            for (unsigned int tex : m_col_texture_ids) {
+                glBindTexture(GL_TEXTURE_2D, tex);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_target_width, m_target_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            }
             glBindTexture(GL_TEXTURE_2D, 0);
 
             QVariant ctx = context()->nativeHandle();
@@ -181,26 +316,54 @@ protected:
 
             qInfo() << "shared context: " << sharedContext;
 
-            m_filament_renderer = new FilamentRenderer();
-            m_filament_renderer->init(nativewindow, sharedContext, render_dim, render_dim, m_col_texture_id);
-
-            m_filament_renderer->resize(width(), height());
+            // the render thread owns the engine; every finished frame makes
+            // the GUI thread composite it.
+            const std::vector<unsigned int> ids(m_col_texture_ids, m_col_texture_ids + kNumTargets);
+            m_render_thread.start(sharedContext, m_target_width, m_target_height, ids, [this]() {
+                QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+            });
+            setViewSize(width(), height());
+
+            if (!m_deferred_file.empty()) {
+                loadFile(m_deferred_file);
+                m_deferred_file.clear();
+            }
         }
     }
 
+    void resizeGL(int w, int h) override
+    {
+        if (!m_render_thread.running())
+            return;
+
+        setViewSize(w, h);
+    }
+
 protected:
     QOpenGLShaderProgram *m_program = nullptr;
     QOpenGLBuffer m_vertex;
     QOpenGLVertexArrayObject m_object;
 
-    unsigned int m_col_texture_id;
+    // Fraction of the widget's width and height the frames are shown on.
+    static constexpr float kQuadSize = 0.5f;
+
+    static const size_t kNumTargets = TargetRing::kMaxSlots;
+    unsigned int m_col_texture_ids[kNumTargets] = {};
+    int m_target_width = 0; // of each texture, frames may cover less
+    int m_target_height = 0;
+    GLsync m_fences[kNumTargets] = {}; // after the last draw sampling each
+    int m_sampled = -1;                // texture shown, -1 before the first frame
     unsigned int m_quad_vao;
     unsigned int m_quad_vbo;
 
-    FilamentRenderer *m_filament_renderer = nullptr;
+    // Draws with the engine off the GUI thread.
+    RenderThread m_render_thread;
 
-    // The asset scene importer.
-    std::unique_ptr<Assimp::Importer> mImporter;
+    // Imports files off the GUI thread.
+    SceneLoader m_loader;
+    QTimer m_load_timer;
+    std::string m_deferred_file;
+    QGraphicsTextItem *m_status_item = nullptr;
 };
 
 //------------------------------------------------------------------------------
@@ -219,7 +382,7 @@ protected:
     {
         qInfo() << "rendering background";
         painter->beginNativePainting();
-        m_render_widget->renderFilament();
+        // only composite the last frame, the render thread draws the next.
         m_render_widget->renderFilamentTexture();
         painter->endNativePainting();
     }
@@ -248,9 +411,13 @@ int main(int argc, char **argv)
     view.setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
     view.setScene(scene);
     view.resize(600, 600);
-    scene->addText("Hello World");
+    rg->setStatusItem(scene->addText("Hello World"));
     view.show();
 
+    // Escape cancels a load that is still in progress.
+    QShortcut *cancel_shortcut = new QShortcut(QKeySequence(Qt::Key_Escape), &view);
+    QObject::connect(cancel_shortcut, &QShortcut::activated, [rg]() { rg->cancelLoad(); });
+
     if (argc == 2) {
         rg->loadFile(argv[1]);
     }
@@ -0,0 +1,346 @@
+#include "mesh_data.h"
+
+#include <filament/RenderableManager.h>
+#include <math/half.h>
+#include <math/mat3.h>
+#include <math/quat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//------------------------------------------------------------------------------
+
+bool convertMesh(aiMesh const *mesh, MeshData &out)
+{
+    using namespace filament;
+    using namespace filament::math;
+
+    out = MeshData();
+
+    float3 const* positions  = reinterpret_cast<float3 const*>(mesh->mVertices);
+    float3 const* tangents   = reinterpret_cast<float3 const*>(mesh->mTangents);
+    float3 const* bitangents = reinterpret_cast<float3 const*>(mesh->mBitangents);
+    float3 const* normals    = reinterpret_cast<float3 const*>(mesh->mNormals);
+    float3 const* texCoords0 = reinterpret_cast<float3 const*>(mesh->mTextureCoords[0]);
+
+    const size_t numVertices = mesh->mNumVertices;
+
+    if (numVertices == 0)
+        return false;
+
+    const aiFace* faces = mesh->mFaces;
+    const size_t numFaces = mesh->mNumFaces;
+
+    if (numFaces == 0)
+        return false;
+
+    // copy the relevant data.
+    out.positions.resize(numVertices);
+    out.uvs.resize(numVertices);
+    out.tangents.resize(numVertices);
+    for (size_t j = 0; j < numVertices; j++) {
+        float3 normal = normals[j];
+        float3 tangent;
+        float3 bitangent;
+
+        // Assimp always returns 3D tex coords but we only support 2D tex coords.
+        float2 texCoord0 = texCoords0 ? texCoords0[j].xy : float2{0.0};
+        // If the tangent and bitangent don't exist, make arbitrary ones. This only
+        // occurs when the mesh is missing texture coordinates, because assimp
+        // computes tangents for us. (search up for aiProcess_CalcTangentSpace)
+        if (!tangents) {
+            bitangent = normalize(cross(normal, float3{1.0, 0.0, 0.0}));
+            tangent = normalize(cross(normal, bitangent));
+        } else {
+            tangent = tangents[j];
+            bitangent = bitangents[j];
+        }
+
+        quatf q = filament::math::details::TMat33<float>::packTangentFrame({tangent, bitangent, normal});
+        out.tangents[j] = q.xyzw;
+        out.uvs[j] = texCoord0;
+        out.positions[j] = positions[j];
+    }
+
+    // Populate the index buffer. All faces are triangles at this point because we
+    // asked assimp to perform triangulation.
+    out.indices.resize(numFaces * 3);
+    for (size_t j = 0; j < numFaces; ++j) {
+        const aiFace& face = faces[j];
+        for (size_t k = 0; k < face.mNumIndices; ++k) {
+            out.indices[j*3 + k] = face.mIndices[k];
+        }
+    }
+
+    out.aabb = RenderableManager::computeAABB(out.positions.data(), out.indices.data(),
+                                              numFaces, sizeof(float3));
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static int16_t packSnorm16(float v)
+{
+    return int16_t(std::round(std::min(1.0f, std::max(-1.0f, v)) * 32767.0f));
+}
+
+// Uniform scale used to quantize positions, the largest half extent.
+static float quantizationScale(const filament::Box &aabb)
+{
+    float scale = std::max(aabb.halfExtent.x, std::max(aabb.halfExtent.y, aabb.halfExtent.z));
+    return scale > 0.0f ? scale : 1.0f;
+}
+
+// Tight bounds of every position.
+static filament::Box boundsOf(const std::vector<filament::math::float3> &positions)
+{
+    using namespace filament::math;
+
+    if (positions.empty())
+        return filament::Box();
+
+    float3 lo = positions[0];
+    float3 hi = positions[0];
+    for (const float3 &p : positions) {
+        lo = min(lo, p);
+        hi = max(hi, p);
+    }
+    filament::Box box;
+    box.set(lo, hi);
+    return box;
+}
+
+//------------------------------------------------------------------------------
+
+size_t MeshData::vertexBytes() const
+{
+    using namespace filament::math;
+
+    if (format == VertexFormat::COMPACT)
+        return vertexCount() * sizeof(CompactVertex);
+    return vertexCount() * (sizeof(float3) + sizeof(float2) + sizeof(float4));
+}
+
+//------------------------------------------------------------------------------
+
+size_t MeshData::indexBytes() const
+{
+    return indexCount() * (hasShortIndices() ? sizeof(uint16_t) : sizeof(uint32_t));
+}
+
+//------------------------------------------------------------------------------
+
+filament::math::mat4f MeshData::dequantization() const
+{
+    using namespace filament::math;
+
+    if (format != VertexFormat::COMPACT)
+        return mat4f();
+    return mat4f(mat3f(quantScale), quantOffset);
+}
+
+//------------------------------------------------------------------------------
+
+filament::Box MeshData::uploadedBounds() const
+{
+    if (format != VertexFormat::COMPACT)
+        return aabb;
+
+    filament::Box bounds;
+    bounds.center = (aabb.center - quantOffset) / quantScale;
+    bounds.halfExtent = aabb.halfExtent / quantScale;
+    return bounds;
+}
+
+//------------------------------------------------------------------------------
+
+void compactVertices(MeshData &mesh, const filament::Box &frame)
+{
+    using namespace filament::math;
+
+    if (mesh.format == VertexFormat::COMPACT || mesh.isMapped())
+        return;
+
+    mesh.quantOffset = frame.center;
+    mesh.quantScale = quantizationScale(frame);
+    const float3 center = mesh.quantOffset;
+    const float inv_scale = 1.0f / mesh.quantScale;
+
+    mesh.compact.resize(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); ++i) {
+        CompactVertex &v = mesh.compact[i];
+        const float3 p = (mesh.positions[i] - center) * inv_scale;
+        v.position[0] = packSnorm16(p.x);
+        v.position[1] = packSnorm16(p.y);
+        v.position[2] = packSnorm16(p.z);
+        v.position[3] = 32767; // w = 1
+
+        // packTangentFrame() already keeps w away from zero at 16 bits.
+        const float4 &q = mesh.tangents[i];
+        for (int c = 0; c < 4; ++c) {
+            v.tangents[c] = packSnorm16(q[c]);
+        }
+
+        v.uv[0] = half(mesh.uvs[i].x).getBits();
+        v.uv[1] = half(mesh.uvs[i].y).getBits();
+    }
+
+    mesh.format = VertexFormat::COMPACT;
+    mesh.positions = std::vector<float3>();
+    mesh.uvs = std::vector<float2>();
+    mesh.tangents = std::vector<float4>();
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<MeshData> splitMesh(MeshData &&mesh, size_t max_vertices)
+{
+    using namespace filament::math;
+
+    std::vector<MeshData> chunks;
+    if (mesh.vertexCount() <= max_vertices || mesh.isMapped() ||
+        mesh.format != VertexFormat::FLOAT || max_vertices < 3) {
+        chunks.push_back(std::move(mesh));
+        return chunks;
+    }
+
+    // Walk the triangles in order and start a new chunk whenever the next
+    // triangle would take the current one over the limit. remap holds the
+    // chunk-local index of each source vertex, valid if its stamp matches.
+    const uint32_t kUnused = ~0u;
+    std::vector<uint32_t> remap(mesh.vertexCount(), kUnused);
+    std::vector<uint32_t> stamp(mesh.vertexCount(), kUnused);
+    uint32_t chunk_id = 0;
+    MeshData chunk;
+
+    auto finish = [&]() {
+        chunk.aabb = boundsOf(chunk.positions);
+        chunks.push_back(std::move(chunk));
+        chunk = MeshData();
+        ++chunk_id;
+    };
+
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        size_t added = 0;
+        for (size_t k = 0; k < 3; ++k) {
+            if (stamp[mesh.indices[t + k]] != chunk_id)
+                ++added;
+        }
+        if (chunk.positions.size() + added > max_vertices)
+            finish();
+
+        for (size_t k = 0; k < 3; ++k) {
+            uint32_t v = mesh.indices[t + k];
+            if (stamp[v] != chunk_id) {
+                stamp[v] = chunk_id;
+                remap[v] = uint32_t(chunk.positions.size());
+                chunk.positions.push_back(mesh.positions[v]);
+                chunk.uvs.push_back(mesh.uvs[v]);
+                chunk.tangents.push_back(mesh.tangents[v]);
+            }
+            chunk.indices.push_back(remap[v]);
+        }
+    }
+    if (!chunk.indices.empty())
+        finish();
+
+    return chunks;
+}
+
+//------------------------------------------------------------------------------
+
+void narrowIndices(MeshData &mesh)
+{
+    if (mesh.isMapped() || mesh.hasShortIndices() || mesh.vertexCount() > kMaxShortIndexVertices)
+        return;
+
+    mesh.shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+    mesh.indices = std::vector<uint32_t>();
+}
+
+//------------------------------------------------------------------------------
+
+bool isBakeableTransform(const filament::math::mat4f &transform)
+{
+    using namespace filament::math;
+
+    if (transform[0][3] != 0.0f || transform[1][3] != 0.0f || transform[2][3] != 0.0f ||
+        transform[3][3] != 1.0f) {
+        return false;
+    }
+
+    const float3 x = transform[0].xyz;
+    const float3 y = transform[1].xyz;
+    const float3 z = transform[2].xyz;
+    const float scale = length(x);
+    if (scale <= 0.0f)
+        return false;
+
+    // uniform scale, orthogonal axes and no mirroring, within rounding.
+    const float tolerance = 1e-3f * scale;
+    return std::abs(length(y) - scale) <= tolerance && std::abs(length(z) - scale) <= tolerance &&
+        std::abs(dot(x, y)) <= tolerance * scale && std::abs(dot(y, z)) <= tolerance * scale &&
+        std::abs(dot(z, x)) <= tolerance * scale && dot(cross(x, y), z) > 0.0f;
+}
+
+//------------------------------------------------------------------------------
+
+void appendMesh(MeshData &batch, const MeshData &mesh, const filament::math::mat4f &transform,
+                const std::string &node, uint32_t source_mesh)
+{
+    using namespace filament::math;
+
+    const uint32_t base = uint32_t(batch.positions.size());
+    const mat3f rotation = transform.upperLeft() * (1.0f / length(transform[0].xyz));
+
+    float3 lo(std::numeric_limits<float>::max());
+    float3 hi(-std::numeric_limits<float>::max());
+    for (size_t v = 0; v < mesh.positions.size(); ++v) {
+        const float3 p = (transform * float4(mesh.positions[v], 1.0f)).xyz;
+        lo = min(lo, p);
+        hi = max(hi, p);
+        batch.positions.push_back(p);
+        batch.uvs.push_back(mesh.uvs[v]);
+
+        // The quaternion holds the frame {t, n x t, n} with the sign of w
+        // telling whether the bitangent is flipped; rotate the frame and
+        // carry the flip over.
+        quatf q;
+        q.xyzw = mesh.tangents[v];
+        mat3f frame = rotation * mat3f(q);
+        if (q.w < 0.0f)
+            frame[1] = -frame[1];
+        batch.tangents.push_back(mat3f::packTangentFrame(frame).xyzw);
+    }
+
+    const uint32_t first = uint32_t(batch.indices.size());
+    for (uint32_t i : mesh.indices) {
+        batch.indices.push_back(base + i);
+    }
+    batch.sources.push_back({ node, source_mesh, first, uint32_t(mesh.indices.size()) });
+
+    filament::Box added;
+    added.set(lo, hi);
+    if (base == 0)
+        batch.aabb = added;
+    else
+        batch.aabb.unionSelf(added);
+}
+
+//------------------------------------------------------------------------------
+
+const MeshData::BatchSource* findBatchSource(const std::vector<MeshData::BatchSource> &sources,
+                                             uint32_t index)
+{
+    // sources are appended in index order.
+    auto it = std::upper_bound(sources.begin(), sources.end(), index,
+                               [](uint32_t i, const MeshData::BatchSource &src) {
+                                   return i < src.firstIndex;
+                               });
+    if (it == sources.begin())
+        return nullptr;
+    --it;
+    return index < it->firstIndex + it->indexCount ? &*it : nullptr;
+}
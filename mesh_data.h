@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <assimp/mesh.h>
+
+#include <filament/Box.h>
+#include <math/mat4.h>
+#include <math/vec2.h>
+#include <math/vec3.h>
+#include <math/vec4.h>
+
+//------------------------------------------------------------------------------
+
+// How vertices are laid out for the engine.
+enum class VertexFormat : uint32_t {
+    // float3 positions, float2 UVs and float4 tangent quaternions in three
+    // streams, 36 bytes per vertex. For models that need full precision.
+    FLOAT = 0,
+    // One interleaved stream of CompactVertex, 20 bytes per vertex.
+    COMPACT = 1,
+};
+
+// Positions are normalized shorts relative to the mesh bounds (see
+// MeshData::dequantization()), the tangent frame quaternion normalized shorts
+// and UVs half floats.
+struct CompactVertex {
+    int16_t position[4];
+    int16_t tangents[4];
+    uint16_t uv[2];
+};
+static_assert(sizeof(CompactVertex) == 20, "CompactVertex must be tightly packed");
+
+// Most vertices a mesh can have and still be drawn with 16-bit indices.
+// Index 0xFFFF is left out: the GL backend enables primitive restart on the
+// fixed index, so a triangle using it would be dropped.
+const size_t kMaxShortIndexVertices = 65535;
+
+// CPU-side staging copy of a mesh, laid out exactly as it is uploaded to the
+// engine. Converting an aiMesh into a MeshData touches no engine state, so it
+// is safe to do on any thread.
+struct MeshData {
+    std::vector<filament::math::float3> positions;
+    std::vector<filament::math::float2> uvs;
+    std::vector<filament::math::float4> tangents; // packed tangent frame quaternions
+    std::vector<uint32_t> indices;
+    filament::Box aabb;
+
+    // COMPACT meshes keep their vertices here and leave the float streams
+    // above empty. Positions are stored as (position - quantOffset) / quantScale.
+    VertexFormat format = VertexFormat::FLOAT;
+    std::vector<CompactVertex> compact;
+    filament::math::float3 quantOffset = {0.0f, 0.0f, 0.0f};
+    float quantScale = 1.0f;
+
+    // Set instead of indices once they have been narrowed to 16 bits.
+    std::vector<uint16_t> shortIndices;
+
+    // Levels of detail as ranges of the indices, finest first. Empty if the
+    // mesh has a single level made of all its indices.
+    struct Lod {
+        uint32_t offset;
+        uint32_t count;
+        float error; // geometric error relative to the bounding radius
+    };
+    std::vector<Lod> lods;
+
+    // The meshes merged into a static batch, so that a triangle can be traced
+    // back to the node and aiScene mesh it was drawn by. Empty unless this
+    // is a batch.
+    struct BatchSource {
+        std::string node;
+        uint32_t mesh;
+        uint32_t firstIndex; // range of the finest LOD's indices
+        uint32_t indexCount;
+    };
+    std::vector<BatchSource> sources;
+
+    // Set instead of the vectors above when the mesh comes from the scene
+    // cache. The streams point into the memory mapped file, which stays
+    // mapped for as long as file is referenced.
+    struct Mapped {
+        std::shared_ptr<const void> file;
+        const filament::math::float3 *positions = nullptr;
+        const filament::math::float2 *uvs = nullptr;
+        const filament::math::float4 *tangents = nullptr;
+        const CompactVertex *compact = nullptr;
+        const uint32_t *indices = nullptr;
+        const uint16_t *shortIndices = nullptr;
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+    } mapped;
+
+    bool isMapped() const { return mapped.file != nullptr; }
+    size_t vertexCount() const {
+        if (isMapped())
+            return mapped.vertexCount;
+        return format == VertexFormat::COMPACT ? compact.size() : positions.size();
+    }
+    size_t indexCount() const {
+        if (isMapped())
+            return mapped.indexCount;
+        return hasShortIndices() ? shortIndices.size() : indices.size();
+    }
+    bool hasShortIndices() const {
+        return isMapped() ? mapped.shortIndices != nullptr : !shortIndices.empty();
+    }
+    bool empty() const { return vertexCount() == 0 || indexCount() == 0; }
+
+    // Bytes of vertex and index data uploaded for this mesh.
+    size_t vertexBytes() const;
+    size_t indexBytes() const;
+
+    // Maps the quantized positions of a COMPACT mesh back into the mesh's own
+    // space, identity for FLOAT meshes. The scale is uniform so that normals
+    // are not skewed.
+    filament::math::mat4f dequantization() const;
+
+    // Bounds of the vertices as they are uploaded, before dequantization().
+    filament::Box uploadedBounds() const;
+};
+
+// Packs the tangent frame, copies UVs and rebuilds the triangle index list of
+// mesh into out. Returns false (leaving out empty) if the mesh has no vertices
+// or no faces.
+bool convertMesh(aiMesh const *mesh, MeshData &out);
+
+// Packs the float streams of mesh into its compact stream and frees them,
+// quantizing positions relative to frame. Meshes split from the same source
+// share a frame so that they can be drawn with the same transform. Does
+// nothing to meshes that are already COMPACT or mapped.
+void compactVertices(MeshData &mesh, const filament::Box &frame);
+inline void compactVertices(MeshData &mesh) { compactVertices(mesh, mesh.aabb); }
+
+// Splits mesh into chunks of at most max_vertices vertices each, so that
+// every chunk can use 16-bit indices. Each chunk gets its own tight bounds.
+// Meshes that already fit are returned as the only chunk. Expects a FLOAT
+// mesh with 32-bit indices.
+std::vector<MeshData> splitMesh(MeshData &&mesh, size_t max_vertices = kMaxShortIndexVertices);
+
+// Replaces indices with shortIndices if the mesh has few enough vertices.
+void narrowIndices(MeshData &mesh);
+
+// True if transform only rotates, translates and scales uniformly, which is
+// what appendMesh() can bake into tangent frames.
+bool isBakeableTransform(const filament::math::mat4f &transform);
+
+// Appends mesh, a FLOAT mesh with 32-bit indices, to the FLOAT batch with
+// transform baked into its positions and tangent frames, and records it in
+// batch.sources. transform must pass isBakeableTransform().
+void appendMesh(MeshData &batch, const MeshData &mesh, const filament::math::mat4f &transform,
+                const std::string &node, uint32_t source_mesh);
+
+// The source of sources that drew index, nullptr if none did.
+const MeshData::BatchSource* findBatchSource(const std::vector<MeshData::BatchSource> &sources,
+                                             uint32_t index);
@@ -0,0 +1,286 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Clusters smaller than this are merged with the next one before sorting, so
+// that their normals mean something.
+const size_t kMinClusterTriangles = 32;
+
+// Triangles around each vertex, as offsets into one flat list.
+struct Adjacency {
+    std::vector<uint32_t> offsets;   // vertex_count + 1
+    std::vector<uint32_t> triangles;
+
+    Adjacency(const std::vector<uint32_t> &indices, size_t vertex_count)
+        : offsets(vertex_count + 1, 0), triangles(indices.size()) {
+        for (uint32_t v : indices) {
+            ++offsets[v + 1];
+        }
+        for (size_t v = 0; v < vertex_count; ++v) {
+            offsets[v + 1] += offsets[v];
+        }
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            triangles[fill[indices[i]]++] = uint32_t(i / 3);
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
+// Tipsify. Returns the new triangle order and, in clusters, the position in
+// that order where each cluster starts; a new cluster starts whenever the fan
+// runs into a dead end and has to jump elsewhere in the mesh.
+std::vector<uint32_t> tipsify(const std::vector<uint32_t> &indices, size_t vertex_count,
+                              unsigned cache_size, std::vector<size_t> &clusters)
+{
+    const size_t num_triangles = indices.size() / 3;
+    const Adjacency adjacency(indices, vertex_count);
+
+    std::vector<uint32_t> live(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(num_triangles, false);
+    std::vector<uint32_t> dead_ends;
+    std::vector<uint32_t> candidates;
+
+    std::vector<uint32_t> order;
+    order.reserve(num_triangles);
+    clusters.assign(1, 0);
+
+    uint32_t time = cache_size + 1;
+    size_t cursor = 0;
+
+    auto skipDeadEnd = [&]() -> int64_t {
+        while (!dead_ends.empty()) {
+            uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live[v] > 0)
+                return v;
+        }
+        while (cursor < vertex_count) {
+            if (live[cursor] > 0)
+                return int64_t(cursor++);
+            ++cursor;
+        }
+        return -1;
+    };
+
+    int64_t fan = skipDeadEnd();
+    while (fan >= 0) {
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; ++a) {
+            uint32_t t = adjacency.triangles[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+            order.push_back(t);
+            for (size_t k = 0; k < 3; ++k) {
+                uint32_t v = indices[t * 3 + k];
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+        }
+
+        // next fan: the candidate that stays in the cache longest while
+        // still having triangles left
+        int64_t next = -1;
+        int64_t best = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        if (next < 0) {
+            next = skipDeadEnd();
+            if (next >= 0 && order.size() < num_triangles)
+                clusters.push_back(order.size());
+        }
+        fan = next;
+    }
+    return order;
+}
+
+//------------------------------------------------------------------------------
+
+// Sorts the clusters so that those facing away from the mesh's center come
+// first; they are the most likely to occlude the rest.
+std::vector<uint32_t> sortClusters(const MeshData &mesh, const std::vector<uint32_t> &order,
+                                   std::vector<size_t> clusters)
+{
+    using namespace filament::math;
+
+    // merge small clusters into the following ones.
+    std::vector<size_t> merged;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        if (merged.empty() || clusters[c] - merged.back() >= kMinClusterTriangles)
+            merged.push_back(clusters[c]);
+    }
+    merged.push_back(order.size());
+
+    struct Cluster {
+        size_t begin, end;
+        float sortKey;
+    };
+    std::vector<Cluster> sorted;
+
+    float3 mesh_center(0.0f);
+    float mesh_area = 0.0f;
+    std::vector<float3> centers;
+    std::vector<float3> normals;
+    for (size_t c = 0; c + 1 < merged.size(); ++c) {
+        float3 center(0.0f);
+        float3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t i = merged[c]; i < merged[c + 1]; ++i) {
+            const uint32_t *tri = &mesh.indices[order[i] * 3];
+            const float3 &a = mesh.positions[tri[0]];
+            const float3 &b = mesh.positions[tri[1]];
+            const float3 &p = mesh.positions[tri[2]];
+            float3 n = cross(b - a, p - a); // length is twice the area
+            float tri_area = length(n) * 0.5f;
+            center += (a + b + p) * (tri_area / 3.0f);
+            normal += n;
+            area += tri_area;
+        }
+        mesh_center += center;
+        mesh_area += area;
+        centers.push_back(area > 0.0f ? center / area : mesh.positions[mesh.indices[order[merged[c]] * 3]]);
+        normals.push_back(length(normal) > 0.0f ? normalize(normal) : float3(0.0f));
+        sorted.push_back({ merged[c], merged[c + 1], 0.0f });
+    }
+    if (mesh_area > 0.0f)
+        mesh_center /= mesh_area;
+
+    for (size_t c = 0; c < sorted.size(); ++c) {
+        sorted[c].sortKey = dot(centers[c] - mesh_center, normals[c]);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(order.size());
+    for (const Cluster &cluster : sorted) {
+        result.insert(result.end(), order.begin() + cluster.begin, order.begin() + cluster.end);
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// Renumbers vertices by first use and reorders the streams to match.
+// Vertices no triangle references are dropped.
+void optimizeVertexFetch(MeshData &mesh)
+{
+    const uint32_t kUnused = ~0u;
+    std::vector<uint32_t> remap(mesh.positions.size(), kUnused);
+    uint32_t next = 0;
+    for (uint32_t &v : mesh.indices) {
+        if (remap[v] == kUnused)
+            remap[v] = next++;
+        v = remap[v];
+    }
+
+    auto reorder = [&](auto &stream) {
+        typename std::decay<decltype(stream)>::type out(next);
+        for (size_t v = 0; v < stream.size(); ++v) {
+            if (remap[v] != kUnused)
+                out[remap[v]] = stream[v];
+        }
+        stream.swap(out);
+    };
+    reorder(mesh.positions);
+    reorder(mesh.uvs);
+    reorder(mesh.tangents);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t index_count,
+                                    size_t vertex_count, unsigned cache_size)
+{
+    VertexCacheStats stats;
+    stats.triangles = index_count / 3;
+
+    // FIFO cache: a vertex is a hit if it entered less than cache_size
+    // misses ago.
+    std::vector<size_t> entered(vertex_count, 0);
+    std::vector<bool> seen(vertex_count, false);
+    for (size_t i = 0; i < index_count; ++i) {
+        uint32_t v = indices[i];
+        if (v >= vertex_count)
+            continue;
+        if (!seen[v]) {
+            seen[v] = true;
+            ++stats.vertices;
+        } else if (stats.transformed - entered[v] < cache_size) {
+            continue;
+        }
+        entered[v] = stats.transformed++;
+    }
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_count)
+{
+    std::vector<size_t> clusters;
+    std::vector<uint32_t> order = tipsify(indices, vertex_count, kVertexCacheSize, clusters);
+
+    std::vector<uint32_t> reordered(order.size() * 3);
+    for (size_t i = 0; i < order.size(); ++i) {
+        std::copy_n(&indices[order[i] * 3], 3, &reordered[i * 3]);
+    }
+    indices.swap(reordered);
+}
+
+//------------------------------------------------------------------------------
+
+void optimizeMesh(MeshData &mesh, VertexCacheStats *before, VertexCacheStats *after)
+{
+    if (mesh.isMapped() || mesh.format != VertexFormat::FLOAT || mesh.hasShortIndices() ||
+        mesh.empty()) {
+        return;
+    }
+
+    const size_t vertex_count = mesh.positions.size();
+    if (before)
+        *before = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), vertex_count);
+
+    std::vector<size_t> clusters;
+    std::vector<uint32_t> order = tipsify(mesh.indices, vertex_count, kVertexCacheSize, clusters);
+    order = sortClusters(mesh, order, clusters);
+
+    std::vector<uint32_t> indices(order.size() * 3);
+    for (size_t i = 0; i < order.size(); ++i) {
+        std::copy_n(&mesh.indices[order[i] * 3], 3, &indices[i * 3]);
+    }
+    mesh.indices.swap(indices);
+
+    optimizeVertexFetch(mesh);
+
+    if (after)
+        *after = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.positions.size());
+}
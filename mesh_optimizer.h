@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_data.h"
+
+//------------------------------------------------------------------------------
+
+// Reorders the triangles and vertices of a mesh for the GPU:
+//
+//  1. Tipsify (Sander, Nehab and Barczak 2007) orders triangles so that the
+//     post-transform vertex cache is reused as much as possible.
+//  2. The clusters Tipsify produces between cache flushes are sorted so that
+//     the ones facing outward from the mesh are drawn first, which reduces
+//     overdraw of the ones behind them.
+//  3. Vertices are renumbered in the order the triangles first use them, so
+//     that vertex fetches walk the attribute streams forward.
+//
+// None of this changes what is drawn, only the order.
+
+// Post-transform cache efficiency of an index buffer, simulated with a FIFO
+// cache. ACMR is the average number of vertices transformed per triangle
+// (0.5 is ideal for large regular meshes, 3 the worst), ATVR the average
+// number of times each vertex is transformed (1 is ideal).
+struct VertexCacheStats {
+    size_t triangles = 0;
+    size_t vertices = 0;     // distinct vertices referenced
+    size_t transformed = 0;  // cache misses
+
+    float acmr() const { return triangles ? float(transformed) / triangles : 0.0f; }
+    float atvr() const { return vertices ? float(transformed) / vertices : 0.0f; }
+
+    VertexCacheStats& operator+=(const VertexCacheStats &other) {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        transformed += other.transformed;
+        return *this;
+    }
+};
+
+// Cache size the optimizer targets and the stats are simulated with.
+const unsigned kVertexCacheSize = 16;
+
+VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t index_count,
+                                    size_t vertex_count,
+                                    unsigned cache_size = kVertexCacheSize);
+
+// Reorders the triangles of an index buffer for the vertex cache only,
+// leaving the vertices where they are. Used for buffers that share their
+// vertices with others, like LODs.
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_count);
+
+// Optimizes a FLOAT mesh with 32-bit indices in place, see above. Mapped or
+// already packed meshes are left alone. Returns the cache stats before and
+// after.
+void optimizeMesh(MeshData &mesh, VertexCacheStats *before = nullptr,
+                  VertexCacheStats *after = nullptr);
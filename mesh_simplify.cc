@@ -0,0 +1,274 @@
+#include "mesh_simplify.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Symmetric 4x4 matrix of a quadric, upper triangle row by row.
+struct Quadric {
+    double m[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // Squared distance to the plane n.p + d = 0.
+    static Quadric plane(const filament::math::float3 &n, float d) {
+        Quadric q;
+        q.m[0] = n.x * n.x; q.m[1] = n.x * n.y; q.m[2] = n.x * n.z; q.m[3] = n.x * d;
+        q.m[4] = n.y * n.y; q.m[5] = n.y * n.z; q.m[6] = n.y * d;
+        q.m[7] = n.z * n.z; q.m[8] = n.z * d;
+        q.m[9] = double(d) * d;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric &o) {
+        for (int i = 0; i < 10; ++i) m[i] += o.m[i];
+        return *this;
+    }
+
+    double evaluate(const filament::math::float3 &p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        double e = m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+                 + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+                 + m[7] * z * z + 2 * m[8] * z
+                 + m[9];
+        return std::max(0.0, e);
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+// Collapses edges of a mesh in passes until it gets down to a target size.
+// The quadrics accumulate across calls, so a chain of LODs is simplified in
+// one run.
+class Simplifier {
+public:
+    Simplifier(const std::vector<uint32_t> &indices,
+               const std::vector<filament::math::float3> &positions)
+        : mIndices(indices), mPositions(positions),
+          mQuadrics(positions.size()), mLocked(positions.size(), false) {
+        using namespace filament::math;
+
+        for (size_t t = 0; t + 2 < mIndices.size(); t += 3) {
+            const float3 &a = mPositions[mIndices[t]];
+            const float3 &b = mPositions[mIndices[t + 1]];
+            const float3 &c = mPositions[mIndices[t + 2]];
+            float3 n = cross(b - a, c - a);
+            float len = length(n);
+            if (len <= 0.0f)
+                continue;
+            n /= len;
+            Quadric q = Quadric::plane(n, -dot(n, a));
+            for (size_t k = 0; k < 3; ++k) {
+                mQuadrics[mIndices[t + k]] += q;
+            }
+        }
+
+        // Edges used by a single triangle are on a boundary; their vertices
+        // stay put.
+        std::unordered_map<uint64_t, uint32_t> edges;
+        auto key = [](uint32_t a, uint32_t b) {
+            return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        };
+        for (size_t t = 0; t + 2 < mIndices.size(); t += 3) {
+            for (size_t k = 0; k < 3; ++k) {
+                ++edges[key(mIndices[t + k], mIndices[t + (k + 1) % 3])];
+            }
+        }
+        for (const auto &edge : edges) {
+            if (edge.second == 1) {
+                mLocked[uint32_t(edge.first >> 32)] = true;
+                mLocked[uint32_t(edge.first)] = true;
+            }
+        }
+    }
+
+    const std::vector<uint32_t>& indices() const { return mIndices; }
+    double error() const { return std::sqrt(mMaxCost); }
+
+    void simplifyTo(size_t target_index_count) {
+        while (mIndices.size() > target_index_count) {
+            if (!collapsePass(target_index_count))
+                break;
+        }
+    }
+
+private:
+    bool flips(uint32_t from, uint32_t to) const {
+        using namespace filament::math;
+
+        for (uint32_t a = mOffsets[from]; a < mOffsets[from + 1]; ++a) {
+            const uint32_t *tri = &mIndices[mTriangles[a] * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+                continue; // collapses away
+            float3 p[3], q[3];
+            for (int k = 0; k < 3; ++k) {
+                p[k] = mPositions[tri[k]];
+                q[k] = tri[k] == from ? mPositions[to] : p[k];
+            }
+            float3 before = cross(p[1] - p[0], p[2] - p[0]);
+            float3 after = cross(q[1] - q[0], q[2] - q[0]);
+            if (dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    void buildAdjacency() {
+        const size_t vertex_count = mPositions.size();
+        mOffsets.assign(vertex_count + 1, 0);
+        for (uint32_t v : mIndices) {
+            ++mOffsets[v + 1];
+        }
+        for (size_t v = 0; v < vertex_count; ++v) {
+            mOffsets[v + 1] += mOffsets[v];
+        }
+        mTriangles.resize(mIndices.size());
+        std::vector<uint32_t> fill(mOffsets.begin(), mOffsets.end() - 1);
+        for (size_t i = 0; i < mIndices.size(); ++i) {
+            mTriangles[fill[mIndices[i]]++] = uint32_t(i / 3);
+        }
+    }
+
+    // One pass collapses the cheapest edges whose neighbourhoods do not
+    // overlap. Returns false if nothing could be collapsed.
+    bool collapsePass(size_t target_index_count) {
+        buildAdjacency();
+
+        std::vector<Collapse> collapses;
+        collapses.reserve(mIndices.size() * 2);
+        for (size_t t = 0; t + 2 < mIndices.size(); t += 3) {
+            for (size_t k = 0; k < 3; ++k) {
+                uint32_t a = mIndices[t + k];
+                uint32_t b = mIndices[t + (k + 1) % 3];
+                Quadric q = mQuadrics[a];
+                q += mQuadrics[b];
+                if (!mLocked[a])
+                    collapses.push_back({ a, b, q.evaluate(mPositions[b]) });
+                if (!mLocked[b])
+                    collapses.push_back({ b, a, q.evaluate(mPositions[a]) });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) {
+            return x.cost < y.cost;
+        });
+
+        std::vector<bool> touched(mPositions.size(), false);
+        std::vector<uint32_t> remap(mPositions.size());
+        for (size_t v = 0; v < remap.size(); ++v) {
+            remap[v] = uint32_t(v);
+        }
+
+        size_t triangles = mIndices.size() / 3;
+        const size_t target_triangles = target_index_count / 3;
+        size_t collapsed = 0;
+        for (const Collapse &c : collapses) {
+            if (triangles <= target_triangles)
+                break;
+            if (touched[c.from] || touched[c.to] || flips(c.from, c.to))
+                continue;
+
+            remap[c.from] = c.to;
+            mQuadrics[c.to] += mQuadrics[c.from];
+            mMaxCost = std::max(mMaxCost, c.cost);
+            ++collapsed;
+
+            // everything around from changes shape, leave it for the next pass
+            for (uint32_t a = mOffsets[c.from]; a < mOffsets[c.from + 1]; ++a) {
+                const uint32_t *tri = &mIndices[mTriangles[a] * 3];
+                bool removed = false;
+                for (int k = 0; k < 3; ++k) {
+                    touched[tri[k]] = true;
+                    removed |= tri[k] == c.to;
+                }
+                if (removed)
+                    --triangles;
+            }
+        }
+        if (collapsed == 0)
+            return false;
+
+        // apply the collapses and drop the triangles that degenerated
+        size_t out = 0;
+        for (size_t t = 0; t + 2 < mIndices.size(); t += 3) {
+            uint32_t a = remap[mIndices[t]];
+            uint32_t b = remap[mIndices[t + 1]];
+            uint32_t c = remap[mIndices[t + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            mIndices[out++] = a;
+            mIndices[out++] = b;
+            mIndices[out++] = c;
+        }
+        mIndices.resize(out);
+        return true;
+    }
+
+    std::vector<uint32_t> mIndices;
+    const std::vector<filament::math::float3> &mPositions;
+    std::vector<Quadric> mQuadrics;
+    std::vector<bool> mLocked;
+    std::vector<uint32_t> mOffsets;
+    std::vector<uint32_t> mTriangles;
+    double mMaxCost = 0.0;
+};
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices,
+                                   const std::vector<filament::math::float3> &positions,
+                                   size_t target_index_count, float *error)
+{
+    Simplifier simplifier(indices, positions);
+    simplifier.simplifyTo(target_index_count);
+    if (error)
+        *error = float(simplifier.error());
+    return simplifier.indices();
+}
+
+//------------------------------------------------------------------------------
+
+void generateLods(MeshData &mesh)
+{
+    if (mesh.isMapped() || mesh.format != VertexFormat::FLOAT || mesh.hasShortIndices() ||
+        !mesh.lods.empty() || mesh.indices.size() / 3 < kMinLodTriangles) {
+        return;
+    }
+
+    // errors are stored relative to the bounding radius.
+    const float radius = length(mesh.aabb.halfExtent);
+    if (radius <= 0.0f)
+        return;
+
+    const size_t full = mesh.indices.size();
+    mesh.lods.push_back({ 0, uint32_t(full), 0.0f });
+
+    Simplifier simplifier(mesh.indices, mesh.positions);
+    size_t previous = full;
+    while (mesh.lods.size() < kMaxLods && previous / 3 >= kMinLodTriangles) {
+        simplifier.simplifyTo(previous / 4);
+
+        // stop once simplification stalls on locked or flipping edges
+        const std::vector<uint32_t> &simplified = simplifier.indices();
+        if (simplified.size() > previous * 3 / 4)
+            break;
+
+        std::vector<uint32_t> lod = simplified;
+        optimizeVertexCache(lod, mesh.positions.size());
+        mesh.lods.push_back({ uint32_t(mesh.indices.size()), uint32_t(lod.size()),
+                              float(simplifier.error()) / radius });
+        mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+        previous = lod.size();
+    }
+
+    if (mesh.lods.size() == 1)
+        mesh.lods.clear();
+}
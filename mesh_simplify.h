@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <math/vec3.h>
+
+#include "mesh_data.h"
+
+//------------------------------------------------------------------------------
+
+// Mesh simplification with the quadric error metric (Garland and Heckbert
+// 1997). Edges are collapsed into one of their existing vertices, so every
+// simplified index buffer still indexes the original vertices and can share
+// the mesh's vertex buffer. Boundary vertices, which include UV and normal
+// seams after JoinIdenticalVertices, are never moved, so the result has no
+// cracks.
+
+// Meshes with fewer triangles than this get no LODs.
+const size_t kMinLodTriangles = 2048;
+
+// Most LODs per mesh, including the full resolution one.
+const size_t kMaxLods = 4;
+
+// Simplifies indices towards target_index_count and returns the simplified
+// index buffer. It may stop short of the target if no edge can be collapsed
+// without flipping a triangle. error receives the largest collapse error, a
+// distance in the units of positions.
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices,
+                                   const std::vector<filament::math::float3> &positions,
+                                   size_t target_index_count, float *error = nullptr);
+
+// Appends simplified LODs, each about a quarter of the triangles of the
+// previous one, to the indices of a FLOAT mesh with 32-bit indices and
+// fills mesh.lods. Small meshes are left alone.
+void generateLods(MeshData &mesh);
@@ -0,0 +1,350 @@
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIPMAP_SSE2 1
+#endif
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// A level being filtered: four floats per pixel, rows tightly packed.
+struct FloatImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> data;
+
+    FloatImage(uint32_t w, uint32_t h) : width(w), height(h), data(size_t(w) * h * 4) {}
+
+    float* pixel(uint32_t x, uint32_t y) { return &data[(size_t(y) * width + x) * 4]; }
+    const float* pixel(uint32_t x, uint32_t y) const { return &data[(size_t(y) * width + x) * 4]; }
+};
+
+// out = sum of weights[i] * in[i], four channels at a time.
+struct Float4 {
+#if MIPMAP_SSE2
+    __m128 v;
+    static Float4 zero() { return { _mm_setzero_ps() }; }
+    static Float4 load(const float *p) { return { _mm_loadu_ps(p) }; }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+    void madd(Float4 a, float w) { v = _mm_add_ps(v, _mm_mul_ps(a.v, _mm_set1_ps(w))); }
+    Float4 operator+(Float4 o) const { return { _mm_add_ps(v, o.v) }; }
+    Float4 operator*(float s) const { return { _mm_mul_ps(v, _mm_set1_ps(s)) }; }
+#else
+    float v[4];
+    static Float4 zero() { return { { 0, 0, 0, 0 } }; }
+    static Float4 load(const float *p) { return { { p[0], p[1], p[2], p[3] } }; }
+    void store(float *p) const { std::copy(v, v + 4, p); }
+    void madd(Float4 a, float w) { for (int i = 0; i < 4; ++i) v[i] += a.v[i] * w; }
+    Float4 operator+(Float4 o) const { return { { v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3] } }; }
+    Float4 operator*(float s) const { return { { v[0] * s, v[1] * s, v[2] * s, v[3] * s } }; }
+#endif
+};
+
+//------------------------------------------------------------------------------
+
+// sRGB <-> linear conversion tables.
+struct SrgbTables {
+    float toLinear[256];
+    uint8_t toSrgb[4096];
+
+    SrgbTables() {
+        for (int i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            float l = i / 4095.0f;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = uint8_t(std::min(255.0f, c * 255.0f + 0.5f));
+        }
+    }
+};
+
+const SrgbTables& srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+uint8_t quantize(float v)
+{
+    return uint8_t(std::min(255.0f, std::max(0.0f, v * 255.0f + 0.5f)));
+}
+
+//------------------------------------------------------------------------------
+
+FloatImage toFloat(const uint8_t *pixels, uint32_t width, uint32_t height,
+                   size_t stride, int channels, MipColorSpace space)
+{
+    const SrgbTables &tables = srgbTables();
+    FloatImage img(width, height);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t *row = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t *p = row + size_t(x) * channels;
+            float *out = img.pixel(x, y);
+            for (int c = 0; c < 3; ++c) {
+                switch (space) {
+                case MipColorSpace::LINEAR: out[c] = p[c] / 255.0f; break;
+                case MipColorSpace::SRGB:   out[c] = tables.toLinear[p[c]]; break;
+                case MipColorSpace::NORMAL: out[c] = p[c] * (2.0f / 255.0f) - 1.0f; break;
+                }
+            }
+            out[3] = channels == 4 ? p[3] / 255.0f : 1.0f;
+        }
+    }
+    return img;
+}
+
+//------------------------------------------------------------------------------
+
+MipLevel toBytes(const FloatImage &img, int channels, MipColorSpace space)
+{
+    const SrgbTables &tables = srgbTables();
+    MipLevel level;
+    level.width = img.width;
+    level.height = img.height;
+    level.pixels.resize(size_t(img.width) * img.height * channels);
+
+    uint8_t *out = level.pixels.data();
+    for (uint32_t y = 0; y < img.height; ++y) {
+        for (uint32_t x = 0; x < img.width; ++x, out += channels) {
+            const float *p = img.pixel(x, y);
+            for (int c = 0; c < 3; ++c) {
+                switch (space) {
+                case MipColorSpace::LINEAR:
+                    out[c] = quantize(p[c]);
+                    break;
+                case MipColorSpace::SRGB: {
+                    float l = std::min(1.0f, std::max(0.0f, p[c]));
+                    out[c] = tables.toSrgb[int(l * 4095.0f + 0.5f)];
+                    break;
+                }
+                case MipColorSpace::NORMAL:
+                    out[c] = quantize(p[c] * 0.5f + 0.5f);
+                    break;
+                }
+            }
+            if (channels == 4)
+                out[3] = quantize(p[3]);
+        }
+    }
+    return level;
+}
+
+//------------------------------------------------------------------------------
+
+void renormalize(FloatImage &img)
+{
+    for (size_t i = 0; i < img.data.size(); i += 4) {
+        float *n = &img.data[i];
+        float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len > 1e-6f) {
+            n[0] /= len;
+            n[1] /= len;
+            n[2] /= len;
+        } else {
+            // the normals cancelled out, point straight up.
+            n[0] = 0.0f;
+            n[1] = 0.0f;
+            n[2] = 1.0f;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+struct Tap {
+    uint32_t index;
+    float weight;
+};
+
+// Source texels under each destination texel of a box halving src samples.
+// An even side takes pairs; an odd side 2n + 1 is covered by n texels of
+// three taps each, weighted by how much of each source texel falls into the
+// destination's footprint, so the edge is kept and nothing shifts.
+struct BoxTaps {
+    Tap taps[3];
+    int count;
+};
+
+std::vector<BoxTaps> boxTaps(uint32_t src)
+{
+    const uint32_t dst = std::max(1u, src / 2);
+    std::vector<BoxTaps> taps(dst);
+    for (uint32_t i = 0; i < dst; ++i) {
+        BoxTaps &t = taps[i];
+        if (src == 1) {
+            t.taps[0] = { 0, 1.0f };
+            t.count = 1;
+        } else if (src % 2 == 0) {
+            t.taps[0] = { 2 * i, 0.5f };
+            t.taps[1] = { 2 * i + 1, 0.5f };
+            t.count = 2;
+        } else {
+            const float n = float(src);
+            t.taps[0] = { 2 * i, (dst - i) / n };
+            t.taps[1] = { 2 * i + 1, dst / n };
+            t.taps[2] = { 2 * i + 2, (i + 1) / n };
+            t.count = 3;
+        }
+    }
+    return taps;
+}
+
+FloatImage downsampleBox(const FloatImage &src)
+{
+    const std::vector<BoxTaps> xtaps = boxTaps(src.width);
+    const std::vector<BoxTaps> ytaps = boxTaps(src.height);
+    FloatImage dst(uint32_t(xtaps.size()), uint32_t(ytaps.size()));
+
+    for (uint32_t y = 0; y < dst.height; ++y) {
+        const BoxTaps &ty = ytaps[y];
+        for (uint32_t x = 0; x < dst.width; ++x) {
+            const BoxTaps &tx = xtaps[x];
+            Float4 acc = Float4::zero();
+            for (int j = 0; j < ty.count; ++j) {
+                for (int i = 0; i < tx.count; ++i) {
+                    acc.madd(Float4::load(src.pixel(tx.taps[i].index, ty.taps[j].index)),
+                             tx.taps[i].weight * ty.taps[j].weight);
+                }
+            }
+            acc.store(dst.pixel(x, y));
+        }
+    }
+    return dst;
+}
+
+//------------------------------------------------------------------------------
+
+// Kaiser window of the given half width, beta = 4.
+float kaiser(float t, float halfWidth)
+{
+    auto besselI0 = [](float x) {
+        // power series, converges quickly for the small arguments used here
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 16; ++k) {
+            term *= (x / (2.0f * k)) * (x / (2.0f * k));
+            sum += term;
+        }
+        return sum;
+    };
+    const float beta = 4.0f;
+    float r = t / halfWidth;
+    if (r * r >= 1.0f)
+        return 0.0f;
+    return besselI0(beta * std::sqrt(1.0f - r * r)) / besselI0(beta);
+}
+
+float sinc(float x)
+{
+    if (std::abs(x) < 1e-6f)
+        return 1.0f;
+    const float pi = 3.14159265358979f;
+    return std::sin(pi * x) / (pi * x);
+}
+
+// Taps of a Kaiser windowed sinc reducing src samples to dst samples. Indices
+// wrap around since the textures are sampled with REPEAT.
+std::vector<std::vector<Tap>> kaiserTaps(uint32_t src, uint32_t dst)
+{
+    const float scale = float(src) / dst;
+    const float radius = 2.0f * scale; // two destination texels each side
+    std::vector<std::vector<Tap>> taps(dst);
+    for (uint32_t i = 0; i < dst; ++i) {
+        float center = (i + 0.5f) * scale;
+        int first = int(std::floor(center - radius));
+        int last = int(std::ceil(center + radius));
+        float total = 0.0f;
+        for (int s = first; s <= last; ++s) {
+            float t = (s + 0.5f) - center;
+            float w = sinc(t / scale) * kaiser(t, radius);
+            if (w == 0.0f)
+                continue;
+            int wrapped = ((s % int(src)) + int(src)) % int(src);
+            taps[i].push_back({ uint32_t(wrapped), w });
+            total += w;
+        }
+        for (Tap &tap : taps[i]) {
+            tap.weight /= total;
+        }
+    }
+    return taps;
+}
+
+FloatImage downsampleKaiser(const FloatImage &src)
+{
+    const uint32_t dw = std::max(1u, src.width / 2);
+    const uint32_t dh = std::max(1u, src.height / 2);
+
+    // separable: horizontal pass into tmp, then vertical pass into dst.
+    auto xtaps = kaiserTaps(src.width, dw);
+    FloatImage tmp(dw, src.height);
+    for (uint32_t y = 0; y < src.height; ++y) {
+        for (uint32_t x = 0; x < dw; ++x) {
+            Float4 acc = Float4::zero();
+            for (const Tap &tap : xtaps[x]) {
+                acc.madd(Float4::load(src.pixel(tap.index, y)), tap.weight);
+            }
+            acc.store(tmp.pixel(x, y));
+        }
+    }
+
+    auto ytaps = kaiserTaps(src.height, dh);
+    FloatImage dst(dw, dh);
+    for (uint32_t y = 0; y < dh; ++y) {
+        for (uint32_t x = 0; x < dw; ++x) {
+            Float4 acc = Float4::zero();
+            for (const Tap &tap : ytaps[y]) {
+                acc.madd(Float4::load(tmp.pixel(x, tap.index)), tap.weight);
+            }
+            acc.store(dst.pixel(x, y));
+        }
+    }
+    return dst;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    uint32_t size = std::max(width, height);
+    while (size > 1) {
+        size /= 2;
+        ++levels;
+    }
+    return levels;
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<MipLevel> generateMipChain(const uint8_t *pixels,
+                                       uint32_t width, uint32_t height,
+                                       size_t stride, int channels,
+                                       MipColorSpace space,
+                                       MipFilter filter)
+{
+    std::vector<MipLevel> chain;
+    if (!pixels || width == 0 || height == 0 || (channels != 3 && channels != 4))
+        return chain;
+
+    // each level is filtered from the previous one at full float precision.
+    FloatImage level = toFloat(pixels, width, height, stride, channels, space);
+    const uint32_t count = mipLevelCount(width, height);
+    chain.reserve(count - 1);
+    for (uint32_t i = 1; i < count; ++i) {
+        level = filter == MipFilter::KAISER ? downsampleKaiser(level) : downsampleBox(level);
+        if (space == MipColorSpace::NORMAL)
+            renormalize(level);
+        chain.push_back(toBytes(level, channels, space));
+    }
+    return chain;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// CPU generation of texture mip chains. Filtering happens in floating point on
+// four channels at a time (SSE2 where available), so it does not depend on the
+// renderer and can be run and timed on its own.
+
+// How the 8-bit channels of an image are interpreted while filtering.
+enum class MipColorSpace {
+    LINEAR, // plain data, e.g. ambient occlusion or specular maps
+    SRGB,   // color in sRGB, filtered in linear space; alpha stays linear
+    NORMAL  // tangent space normals in [0, 255], renormalized on every level
+};
+
+enum class MipFilter {
+    BOX,   // 2x2 average, 3 taps along odd sides
+    KAISER // Kaiser windowed sinc, sharper than a box
+};
+
+struct MipLevel {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels; // tightly packed rows of channels bytes
+};
+
+// Number of levels of a full chain down to 1x1.
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// Builds levels 1 .. mipLevelCount(width, height) - 1 of the image at pixels,
+// which has 3 or 4 channels of 8 bits and rows stride bytes apart. Level 0 is
+// not included since it is the source image itself.
+std::vector<MipLevel> generateMipChain(const uint8_t *pixels,
+                                       uint32_t width, uint32_t height,
+                                       size_t stride, int channels,
+                                       MipColorSpace space,
+                                       MipFilter filter = MipFilter::BOX);
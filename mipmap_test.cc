@@ -0,0 +1,173 @@
+#include "mipmap.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// Checks the mip generator on small images and, with --benchmark, times it
+// per megapixel on one thread. It has no Qt or Filament dependency.
+//
+//   mipmap_test                      run the checks
+//   mipmap_test --benchmark [size]   also time a size x size image, 2048 by default
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond)) {                                          \
+            std::printf("%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            std::printf(__VA_ARGS__);                           \
+            std::printf("\n");                                  \
+            ++failures;                                         \
+        }                                                       \
+    } while (0)
+
+std::vector<uint8_t> randomImage(uint32_t width, uint32_t height, int channels, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> pixels(size_t(width) * height * channels);
+    for (uint8_t &p : pixels) {
+        p = uint8_t(byte(rng));
+    }
+    return pixels;
+}
+
+//------------------------------------------------------------------------------
+
+// A flat sRGB image comes back with the value it went in with.
+void testSrgbRoundTrip()
+{
+    for (int v = 0; v < 256; ++v) {
+        std::vector<uint8_t> pixels(2 * 2 * 3, uint8_t(v));
+        std::vector<MipLevel> chain = generateMipChain(pixels.data(), 2, 2, 2 * 3, 3, MipColorSpace::SRGB);
+        CHECK(chain.size() == 1, "%zu levels", chain.size());
+        if (chain.empty())
+            continue;
+        for (int c = 0; c < 3; ++c) {
+            CHECK(chain[0].pixels[c] == v, "sRGB %d came back as %d", v, chain[0].pixels[c]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Averaged normals are unit length again on every level.
+void testNormalRenormalization()
+{
+    const uint32_t size = 16;
+    std::vector<uint8_t> pixels = randomImage(size, size, 3, 1);
+    std::vector<MipLevel> chain = generateMipChain(pixels.data(), size, size, size * 3, 3,
+                                                   MipColorSpace::NORMAL);
+    CHECK(chain.size() == 4, "%zu levels", chain.size());
+    for (const MipLevel &level : chain) {
+        for (size_t i = 0; i < level.pixels.size(); i += 3) {
+            float n[3];
+            for (int c = 0; c < 3; ++c) {
+                n[c] = level.pixels[i + c] * (2.0f / 255.0f) - 1.0f;
+            }
+            const float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            // 8 bits per channel leave about 1% of error
+            CHECK(std::abs(len - 1.0f) < 0.02f, "normal of length %f on a %ux%u level",
+                  len, level.width, level.height);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Odd sides keep their last row and column, and the mean stays put.
+void testOddSizes()
+{
+    // the bright last texel has to make it into the single output texel.
+    const uint8_t row[3 * 3] = { 0, 0, 0, 0, 0, 0, 255, 255, 255 };
+    std::vector<MipLevel> chain = generateMipChain(row, 3, 1, sizeof(row), 3, MipColorSpace::LINEAR);
+    CHECK(chain.size() == 1 && chain[0].width == 1 && chain[0].height == 1, "3x1 chain");
+    if (!chain.empty())
+        CHECK(chain[0].pixels[0] == 85, "3x1 halved to %d, expected 85", chain[0].pixels[0]);
+
+    const uint32_t width = 7;
+    const uint32_t height = 5;
+    std::vector<uint8_t> pixels = randomImage(width, height, 4, 2);
+    chain = generateMipChain(pixels.data(), width, height, width * 4, 4, MipColorSpace::LINEAR);
+    CHECK(chain.size() == mipLevelCount(width, height) - 1, "%zu levels", chain.size());
+    const uint32_t sizes[][2] = { { 3, 2 }, { 1, 1 } };
+    for (size_t l = 0; l < chain.size() && l < 2; ++l) {
+        CHECK(chain[l].width == sizes[l][0] && chain[l].height == sizes[l][1],
+              "level %zu is %ux%u", l + 1, chain[l].width, chain[l].height);
+    }
+
+    auto mean = [](const std::vector<uint8_t> &p) {
+        double sum = 0.0;
+        for (uint8_t v : p) {
+            sum += v;
+        }
+        return sum / p.size();
+    };
+    const double source_mean = mean(pixels);
+    for (const MipLevel &level : chain) {
+        const double level_mean = mean(level.pixels);
+        CHECK(std::abs(level_mean - source_mean) < 1.0, "mean %f on a %ux%u level, %f in the source",
+              level_mean, level.width, level.height, source_mean);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void benchmark(uint32_t size)
+{
+    using clock = std::chrono::steady_clock;
+
+    const int runs = 5;
+    const std::vector<uint8_t> pixels = randomImage(size, size, 4, 3);
+    const double megapixels = size * double(size) / 1e6;
+    const struct {
+        const char *name;
+        MipColorSpace space;
+        MipFilter filter;
+    } cases[] = {
+        { "box, linear", MipColorSpace::LINEAR, MipFilter::BOX },
+        { "box, sRGB", MipColorSpace::SRGB, MipFilter::BOX },
+        { "box, normal", MipColorSpace::NORMAL, MipFilter::BOX },
+        { "kaiser, sRGB", MipColorSpace::SRGB, MipFilter::KAISER },
+    };
+    for (const auto &c : cases) {
+        // the fastest run, the others lost time to something else.
+        double best = 0.0;
+        for (int run = 0; run < runs; ++run) {
+            const auto start = clock::now();
+            generateMipChain(pixels.data(), size, size, size * 4, 4, c.space, c.filter);
+            const double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            best = run == 0 ? ms : std::min(best, ms);
+        }
+        std::printf("%-14s %ux%u RGBA: %.2f ms, %.2f ms/MP\n", c.name, size, size, best, best / megapixels);
+    }
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    testSrgbRoundTrip();
+    testNormalRenormalization();
+    testOddSizes();
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0)
+        benchmark(argc > 2 ? uint32_t(std::atoi(argv[2])) : 2048u);
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include "occlusion_culler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2 1
+#endif
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Vertices nearer than this (in clip w) are treated as crossing the near plane.
+const float kMinW = 1e-5f;
+
+float unpackSnorm16(int16_t v)
+{
+    return std::max(float(v) / 32767.0f, -1.0f);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+OccluderMesh makeOccluderMesh(const MeshData &mesh, size_t max_triangles)
+{
+    using namespace filament::math;
+
+    OccluderMesh occluder;
+    if (mesh.empty())
+        return occluder;
+
+    size_t first = 0;
+    size_t count = mesh.indexCount();
+    if (!mesh.lods.empty()) {
+        first = mesh.lods.back().offset;
+        count = mesh.lods.back().count;
+    }
+    if (count / 3 > max_triangles)
+        return occluder;
+
+    const bool mapped = mesh.isMapped();
+    const uint32_t *indices = mapped ? mesh.mapped.indices : mesh.indices.data();
+    const uint16_t *short_indices = mapped ? mesh.mapped.shortIndices : mesh.shortIndices.data();
+    const bool short_index = mesh.hasShortIndices();
+
+    const bool compact = mesh.format == VertexFormat::COMPACT;
+    const float3 *positions = mapped ? mesh.mapped.positions : mesh.positions.data();
+    const CompactVertex *vertices = mapped ? mesh.mapped.compact : mesh.compact.data();
+    const size_t vertex_count = mesh.vertexCount();
+
+    // keep only the vertices the occluder uses.
+    const uint32_t kUnused = ~0u;
+    std::vector<uint32_t> remap(vertex_count, kUnused);
+    occluder.indices.reserve(count);
+    for (size_t i = first; i < first + count; ++i) {
+        const uint32_t v = short_index ? short_indices[i] : indices[i];
+        if (v >= vertex_count)
+            return OccluderMesh();
+        if (remap[v] == kUnused) {
+            remap[v] = uint32_t(occluder.positions.size());
+            if (compact) {
+                const int16_t *p = vertices[v].position;
+                occluder.positions.push_back({ unpackSnorm16(p[0]), unpackSnorm16(p[1]),
+                                               unpackSnorm16(p[2]) });
+            } else {
+                occluder.positions.push_back(positions[v]);
+            }
+        }
+        occluder.indices.push_back(remap[v]);
+    }
+    return occluder;
+}
+
+//------------------------------------------------------------------------------
+
+void OcclusionCuller::setResolution(uint32_t width, uint32_t height)
+{
+    mWidth = std::max((width + 3) & ~3u, 4u);
+    mHeight = std::max(height, 1u);
+    mDepth.assign(size_t(mWidth) * mHeight, 0.0f);
+}
+
+//------------------------------------------------------------------------------
+
+void OcclusionCuller::begin(const filament::math::mat4f &clip_from_space)
+{
+    mClipFromSpace = clip_from_space;
+    std::fill(mDepth.begin(), mDepth.end(), 0.0f);
+}
+
+//------------------------------------------------------------------------------
+
+size_t OcclusionCuller::rasterize(const OccluderMesh &mesh,
+                                  const filament::math::mat4f &space_from_mesh)
+{
+    using namespace filament::math;
+
+    const mat4f clip_from_mesh = mClipFromSpace * space_from_mesh;
+
+    // to screen space: x and y in pixels, z is 1/w. Vertices behind the near
+    // plane get z < 0 and make their triangles be skipped.
+    std::vector<float3> screen(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); ++i) {
+        const float4 clip = clip_from_mesh * float4(mesh.positions[i], 1.0f);
+        if (clip.w < kMinW) {
+            screen[i] = float3(0.0f, 0.0f, -1.0f);
+            continue;
+        }
+        const float inv_w = 1.0f / clip.w;
+        screen[i] = float3((clip.x * inv_w * 0.5f + 0.5f) * mWidth,
+                           (clip.y * inv_w * 0.5f + 0.5f) * mHeight,
+                           inv_w);
+    }
+
+    size_t rasterized = 0;
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        const float3 &a = screen[mesh.indices[t]];
+        const float3 &b = screen[mesh.indices[t + 1]];
+        const float3 &c = screen[mesh.indices[t + 2]];
+        if (a.z < 0.0f || b.z < 0.0f || c.z < 0.0f)
+            continue;
+        rasterizeTriangle(a, b, c);
+        ++rasterized;
+    }
+    return rasterized;
+}
+
+//------------------------------------------------------------------------------
+
+void OcclusionCuller::rasterizeTriangle(const filament::math::float3 &a,
+                                        const filament::math::float3 &b_in,
+                                        const filament::math::float3 &c_in)
+{
+    using namespace filament::math;
+
+    // both windings occlude, make it counter-clockwise.
+    float area = (b_in.x - a.x) * (c_in.y - a.y) - (b_in.y - a.y) * (c_in.x - a.x);
+    if (area == 0.0f)
+        return;
+    const float3 &b = area > 0.0f ? b_in : c_in;
+    const float3 &c = area > 0.0f ? c_in : b_in;
+    area = std::abs(area);
+
+    const int x_min = std::max(int(std::floor(std::min({ a.x, b.x, c.x }))), 0);
+    const int x_max = std::min(int(std::ceil(std::max({ a.x, b.x, c.x }))), int(mWidth) - 1);
+    const int y_min = std::max(int(std::floor(std::min({ a.y, b.y, c.y }))), 0);
+    const int y_max = std::min(int(std::ceil(std::max({ a.y, b.y, c.y }))), int(mHeight) - 1);
+    if (x_min > x_max || y_min > y_max)
+        return;
+
+    // Edge functions, positive inside, and their steps per pixel.
+    struct Edge {
+        float dx, dy, c;
+        Edge(const float3 &p, const float3 &q)
+            : dx(-(q.y - p.y)), dy(q.x - p.x), c(-(p.x * dx + p.y * dy)) {}
+        float at(float x, float y) const { return x * dx + y * dy + c; }
+    };
+    const Edge e0(a, b), e1(b, c), e2(c, a);
+
+    // Depth plane, lowered by half a pixel's worth of slope so that the depth
+    // written is never nearer than the triangle anywhere in the pixel.
+    const float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+    const float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+    const float z0 = a.z - a.x * dzdx - a.y * dzdy - 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+
+    // pixels are handled 4 at a time starting on a multiple of 4, so a row
+    // never runs past the buffer's (padded) width.
+    const int x_start = x_min & ~3;
+    for (int y = y_min; y <= y_max; ++y) {
+        const float py = y + 0.5f;
+        float *row = &mDepth[size_t(y) * mWidth];
+#if OCCLUSION_SSE2
+        const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 e0_dx = _mm_set1_ps(e0.dx), e1_dx = _mm_set1_ps(e1.dx), e2_dx = _mm_set1_ps(e2.dx);
+        const __m128 z_dx = _mm_set1_ps(dzdx);
+        const __m128 zero = _mm_setzero_ps();
+        for (int x = x_start; x <= x_max; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(px, e0_dx), _mm_set1_ps(py * e0.dy + e0.c));
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(px, e1_dx), _mm_set1_ps(py * e1.dy + e1.c));
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(px, e2_dx), _mm_set1_ps(py * e2.dy + e2.c));
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)),
+                                       _mm_cmpge_ps(w2, zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+            __m128 z = _mm_add_ps(_mm_mul_ps(px, z_dx), _mm_set1_ps(py * dzdy + z0));
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_max_ps(old, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+        }
+#else
+        for (int x = x_start; x <= x_max; ++x) {
+            const float px = x + 0.5f;
+            if (e0.at(px, py) >= 0.0f && e1.at(px, py) >= 0.0f && e2.at(px, py) >= 0.0f)
+                row[x] = std::max(row[x], px * dzdx + py * dzdy + z0);
+        }
+#endif
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool OcclusionCuller::isVisible(const filament::Box &box) const
+{
+    using namespace filament::math;
+
+    const float3 lo = box.getMin();
+    const float3 hi = box.getMax();
+    float x_lo = float(mWidth), x_hi = 0.0f;
+    float y_lo = float(mHeight), y_hi = 0.0f;
+    float nearest = 0.0f;
+    for (int i = 0; i < 8; ++i) {
+        const float3 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+        const float4 clip = mClipFromSpace * float4(corner, 1.0f);
+        if (clip.w < kMinW)
+            return true;
+        const float inv_w = 1.0f / clip.w;
+        const float x = (clip.x * inv_w * 0.5f + 0.5f) * mWidth;
+        const float y = (clip.y * inv_w * 0.5f + 0.5f) * mHeight;
+        x_lo = std::min(x_lo, x);
+        x_hi = std::max(x_hi, x);
+        y_lo = std::min(y_lo, y);
+        y_hi = std::max(y_hi, y);
+        nearest = std::max(nearest, inv_w);
+    }
+
+    const int x_min = std::max(int(std::floor(x_lo)), 0);
+    const int x_max = std::min(int(std::floor(x_hi)), int(mWidth) - 1);
+    const int y_min = std::max(int(std::floor(y_lo)), 0);
+    const int y_max = std::min(int(std::floor(y_hi)), int(mHeight) - 1);
+    if (x_min > x_max || y_min > y_max)
+        return true; // off screen, leave it to the frustum test
+
+    // visible as soon as one pixel has no occluder nearer than the box.
+    for (int y = y_min; y <= y_max; ++y) {
+        const float *row = &mDepth[size_t(y) * mWidth];
+#if OCCLUSION_SSE2
+        const __m128 box_depth = _mm_set1_ps(nearest);
+        int x = x_min;
+        for (; x + 3 <= x_max; x += 4) {
+            if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), box_depth)) != 0)
+                return true;
+        }
+        for (; x <= x_max; ++x) {
+            if (row[x] <= nearest)
+                return true;
+        }
+#else
+        for (int x = x_min; x <= x_max; ++x) {
+            if (row[x] <= nearest)
+                return true;
+        }
+#endif
+    }
+    return false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <filament/Box.h>
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+#include "mesh_data.h"
+
+//------------------------------------------------------------------------------
+
+// Software occlusion culling. A few large occluders are rasterized into a
+// small depth buffer on the CPU, then bounding boxes are tested against it;
+// a box whose screen rectangle is covered by nearer occluder depth everywhere
+// cannot be seen. Nothing here touches the engine, so it runs headless.
+//
+// Depth is stored as 1/w, which is affine in screen space and does not depend
+// on the depth range convention of the projection: larger is nearer, 0 is
+// infinitely far. Occluder triangles crossing the near plane are skipped and
+// boxes crossing it are visible, both of which only make the result more
+// conservative.
+
+// Positions of an occluder in the space its renderable is drawn in (the
+// uploaded space of a mesh) and its triangles.
+struct OccluderMesh {
+    std::vector<filament::math::float3> positions;
+    std::vector<uint32_t> indices;
+
+    bool empty() const { return indices.empty(); }
+};
+
+// Coarse occluder geometry for mesh: its coarsest LOD, or all of it if it has
+// none. Returns an empty occluder if that has more than max_triangles.
+OccluderMesh makeOccluderMesh(const MeshData &mesh, size_t max_triangles);
+
+class OcclusionCuller {
+public:
+    static const uint32_t kDefaultWidth = 256;
+    static const uint32_t kDefaultHeight = 128;
+
+    OcclusionCuller() { setResolution(kDefaultWidth, kDefaultHeight); }
+
+    // Width is rounded up to a multiple of 4.
+    void setResolution(uint32_t width, uint32_t height);
+    uint32_t width() const { return mWidth; }
+    uint32_t height() const { return mHeight; }
+
+    // Clears the depth buffer for a frame seen through clip_from_space.
+    void begin(const filament::math::mat4f &clip_from_space);
+
+    // Rasterizes an occluder drawn with space_from_mesh. Returns the number of
+    // triangles rasterized.
+    size_t rasterize(const OccluderMesh &mesh, const filament::math::mat4f &space_from_mesh);
+
+    // False if box, in the space given to begin(), is entirely hidden behind
+    // what has been rasterized.
+    bool isVisible(const filament::Box &box) const;
+
+    // Row major, 1/w per pixel.
+    const std::vector<float>& depth() const { return mDepth; }
+
+private:
+    void rasterizeTriangle(const filament::math::float3 &a, const filament::math::float3 &b,
+                           const filament::math::float3 &c);
+
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    filament::math::mat4f mClipFromSpace;
+    std::vector<float> mDepth;
+};
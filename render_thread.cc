@@ -0,0 +1,207 @@
+#include "render_thread.h"
+
+#include <QtDebug>
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+
+void RenderThread::start(void *shared_context, int width, int height,
+                         const std::vector<unsigned int> &col_texture_ids,
+                         std::function<void()> frame_completed)
+{
+    stop();
+
+    mFrameCompleted = std::move(frame_completed);
+    mTargets.reset(new TargetRing(col_texture_ids.size()));
+    mStopping = false;
+    mStarted = false;
+    mThread = std::thread([=]() { run(shared_context, width, height, col_texture_ids); });
+
+    // the GUI needs the renderer's build options before it can load anything.
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this]() { return mStarted; });
+    mStatus.update();
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::stop()
+{
+    if (!mThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    mThread.join();
+    mCommands.clear();
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::post(std::function<void(FilamentRenderer&)> command)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCommands.push_back(std::move(command));
+    }
+    mCondition.notify_all();
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::setSceneData(std::unique_ptr<SceneData> data)
+{
+    // std::function has to be copyable, so the scene travels in a holder.
+    auto holder = std::make_shared<std::unique_ptr<SceneData>>(std::move(data));
+    ++mScenesPosted;
+    post([this, holder](FilamentRenderer &renderer) {
+        renderer.setSceneData(std::move(*holder));
+        ++mScenesAccepted;
+    });
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::cancelPendingScene()
+{
+    post([](FilamentRenderer &renderer) { renderer.cancelPendingScene(); });
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::requestRedraw()
+{
+    post([](FilamentRenderer &renderer) { renderer.requestRedraw(); });
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::setViewState(const ViewState &state)
+{
+    mViewState = state;
+    mViewStates.back() = state;
+    mViewStates.publish();
+
+    // an idle render thread sleeps until woken; taking the lock makes sure
+    // it is either still before its check or already waiting.
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+    }
+    mCondition.notify_all();
+}
+
+//------------------------------------------------------------------------------
+
+const RenderThread::Status& RenderThread::status()
+{
+    mStatus.update();
+    return mStatus.front();
+}
+
+//------------------------------------------------------------------------------
+
+bool RenderThread::hasPendingScene()
+{
+    const Status &current = status();
+    return current.pendingScene || current.scenesAccepted < mScenesPosted;
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::publishStatus(const FilamentRenderer &renderer, uint64_t frames)
+{
+    Status &status = mStatus.back();
+    status.buildOptions = renderer.sceneBuildOptions();
+    status.scenesAccepted = mScenesAccepted;
+    status.pendingScene = renderer.hasPendingScene();
+    status.pendingProgress = status.pendingScene ? renderer.pendingSceneProgress() : 1.0f;
+    status.frames = frames;
+    mStatus.publish();
+}
+
+//------------------------------------------------------------------------------
+
+void RenderThread::run(void *shared_context, int width, int height,
+                       std::vector<unsigned int> col_texture_ids)
+{
+    // the engine lives and dies on this thread.
+    std::unique_ptr<FilamentRenderer> renderer(new FilamentRenderer());
+    renderer->init(nullptr, shared_context, width, height, col_texture_ids, mTargets.get());
+
+    uint64_t frames = 0;
+    publishStatus(*renderer, frames);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStarted = true;
+    }
+    mCondition.notify_all();
+
+    ViewState applied;
+    uint64_t ready_frames = 0;
+    std::deque<std::function<void(FilamentRenderer&)>> commands;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mStopping)
+                break;
+            commands.swap(mCommands);
+        }
+        for (const auto &command : commands) {
+            command(*renderer);
+        }
+        const bool had_commands = !commands.empty();
+        commands.clear();
+
+        if (mViewStates.update()) {
+            const ViewState &state = mViewStates.front();
+            if (state.width > 0 && state.height > 0 &&
+                (state.width != applied.width || state.height != applied.height)) {
+                renderer->resize(state.width, state.height);
+            }
+            applied = state;
+        }
+
+        const bool drawn = renderer->tryDraw();
+
+        // frames are ready once their fence signals, which may be a few
+        // tries after they were drawn.
+        const uint64_t rendered = mTargets->stats().rendered;
+        if (rendered != ready_frames) {
+            ready_frames = rendered;
+            if (mFrameCompleted)
+                mFrameCompleted();
+        }
+
+        if (drawn) {
+            publishStatus(*renderer, ++frames);
+            continue;
+        }
+        if (had_commands)
+            publishStatus(*renderer, frames);
+
+        // sleep until the next frame is due, or at least a little while the
+        // engine catches up with a skipped one, unless the GUI has news.
+        // With nothing to draw, only the GUI can wake the thread.
+        auto has_news = [this]() {
+            return mStopping || !mCommands.empty() || mViewStates.pending();
+        };
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (renderer->needsFrame()) {
+            // frames in flight are polled for closely, the GUI gets them
+            // sooner and their times drive the resolution scale.
+            const std::chrono::microseconds poll(1000);
+            auto wait = renderer->timeUntilNextFrame();
+            if (renderer->framesInFlight())
+                wait = std::min(wait, poll);
+            mCondition.wait_for(lock, std::max(wait, poll), has_news);
+        } else {
+            mCondition.wait(lock, has_news);
+        }
+    }
+
+    renderer.reset();
+}
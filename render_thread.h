@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "filament_renderer.h"
+#include "scene_data.h"
+#include "target_ring.h"
+
+//------------------------------------------------------------------------------
+
+// Hands the latest value of T from one producer thread to one consumer
+// thread without locks. Each side has a slot of its own to write or read,
+// and a third slot holds the value published last; publishing and picking
+// up swap a side's slot with that one in a single atomic exchange, so
+// neither side ever waits for the other and values nobody read are simply
+// replaced.
+template <typename T>
+class SnapshotBuffer {
+public:
+    // Producer: fill back(), then publish() it.
+    T& back() { return mSlots[mBack]; }
+    void publish() { mBack = mMiddle.exchange(mBack | kFresh) & kIndex; }
+
+    // Consumer: picks up the value published last, if there is a new one,
+    // and returns whether there was. front() is the latest picked up.
+    bool update() {
+        if (!(mMiddle.load() & kFresh))
+            return false;
+        mFront = mMiddle.exchange(mFront) & kIndex;
+        return true;
+    }
+    const T& front() const { return mSlots[mFront]; }
+
+    // Consumer: true if update() would pick up a new value.
+    bool pending() const { return (mMiddle.load() & kFresh) != 0; }
+
+private:
+    static const uint32_t kIndex = 3;
+    static const uint32_t kFresh = 4;
+
+    T mSlots[3];
+    uint32_t mBack = 0;
+    uint32_t mFront = 1;
+    std::atomic<uint32_t> mMiddle{2};
+};
+
+//------------------------------------------------------------------------------
+
+// Runs a FilamentRenderer on a thread of its own, which creates, owns and
+// destroys the engine and draws frames at the renderer's target rate while
+// something changes; otherwise it sleeps until the GUI has news. The GUI
+// thread never calls into the renderer: it publishes its view state, queues
+// commands, reads the status published after every frame and only
+// composites the texture the renderer draws into.
+class RenderThread {
+public:
+    // What the GUI controls, applied before the next frame: the size of the
+    // view in pixels.
+    struct ViewState {
+        uint32_t width = 0;
+        uint32_t height = 0;
+    };
+
+    // What the GUI shows, published by the render thread.
+    struct Status {
+        SceneBuildOptions buildOptions;
+        uint64_t scenesAccepted = 0; // setSceneData() calls the renderer has seen
+        bool pendingScene = false;
+        float pendingProgress = 0.0f;
+        uint64_t frames = 0;
+    };
+
+    RenderThread() = default;
+    ~RenderThread() { stop(); }
+
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    // Starts the thread and blocks until the renderer has been initialized,
+    // see FilamentRenderer::init(). The renderer draws into a ring of the
+    // GL textures col_texture_ids, see targets(). frame_completed is called
+    // on the render thread whenever a frame is ready to be picked up.
+    void start(void *shared_context, int width, int height,
+               const std::vector<unsigned int> &col_texture_ids,
+               std::function<void()> frame_completed);
+
+    // Destroys the renderer and joins the thread.
+    void stop();
+
+    bool running() const { return mThread.joinable(); }
+
+    // Hands the textures between the renderer and the GUI, which picks up
+    // and retires them from its side. Valid while running().
+    TargetRing& targets() { return *mTargets; }
+
+    // Runs command with the renderer on the render thread before the next
+    // frame. Commands run in the order they were queued.
+    void post(std::function<void(FilamentRenderer&)> command);
+
+    void setSceneData(std::unique_ptr<SceneData> data);
+    void cancelPendingScene();
+
+    // Draws the next frame even if nothing changed, see
+    // FilamentRenderer::requestRedraw().
+    void requestRedraw();
+
+    // Latest view state, picked up before the next frame.
+    void setViewState(const ViewState &state);
+    const ViewState& viewState() const { return mViewState; }
+
+    // Latest published status.
+    const Status& status();
+
+    // True while a scene handed over by setSceneData() has not been fully
+    // created yet, counting scenes the render thread has not seen yet.
+    bool hasPendingScene();
+
+private:
+    void run(void *shared_context, int width, int height,
+             std::vector<unsigned int> col_texture_ids);
+    void publishStatus(const FilamentRenderer &renderer, uint64_t frames);
+
+    std::thread mThread;
+    std::function<void()> mFrameCompleted;
+    std::unique_ptr<TargetRing> mTargets;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<std::function<void(FilamentRenderer&)>> mCommands;
+    bool mStopping = false;
+    bool mStarted = false;
+
+    ViewState mViewState; // the GUI's copy
+    SnapshotBuffer<ViewState> mViewStates;
+    SnapshotBuffer<Status> mStatus;
+    uint64_t mScenesPosted = 0; // GUI side
+    uint64_t mScenesAccepted = 0; // render thread side
+};
@@ -0,0 +1,76 @@
+#include "resolution_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr float ResolutionController::kDeadband;
+constexpr float ResolutionController::kMaxDecrease;
+constexpr float ResolutionController::kMaxIncrease;
+
+//------------------------------------------------------------------------------
+
+void ResolutionController::setTargetFrameTime(std::chrono::microseconds frame_time)
+{
+    mTarget = std::max(frame_time, std::chrono::microseconds(0));
+    if (mTarget.count() == 0)
+        mScale = mMaxScale;
+    restart();
+}
+
+//------------------------------------------------------------------------------
+
+void ResolutionController::setScaleRange(float min_scale, float max_scale)
+{
+    mMaxScale = std::min(std::max(max_scale, 0.01f), 1.0f);
+    mMinScale = std::min(std::max(min_scale, 0.01f), mMaxScale);
+    mScale = mTarget.count() > 0 ? std::min(std::max(mScale, mMinScale), mMaxScale) : mMaxScale;
+    restart();
+}
+
+//------------------------------------------------------------------------------
+
+void ResolutionController::restart()
+{
+    mWindowTime = std::chrono::microseconds(0);
+    mWindowFrames = 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool ResolutionController::frameTimed(std::chrono::microseconds frame_time)
+{
+    if (mTarget.count() == 0)
+        return false;
+
+    mWindowTime += frame_time;
+    if (++mWindowFrames < kWindow)
+        return false;
+
+    const float average = float(mWindowTime.count()) / mWindowFrames;
+    restart();
+    const float ratio = float(mTarget.count()) / std::max(average, 1.0f);
+    if (std::abs(ratio - 1.0f) < kDeadband)
+        return false;
+
+    const float step = std::min(std::max(std::sqrt(ratio), kMaxDecrease), kMaxIncrease);
+    const float scale = std::min(std::max(mScale * step, mMinScale), mMaxScale);
+    if (scale == mScale)
+        return false;
+    mScale = scale;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void ResolutionController::extent(float scale, uint32_t width, uint32_t height,
+                                  uint32_t max_width, uint32_t max_height,
+                                  uint32_t &scaled_width, uint32_t &scaled_height)
+{
+    if (width > 0 && height > 0) {
+        // shrink both sides alike so the aspect ratio holds.
+        scale = std::min(scale, float(max_width) / width);
+        scale = std::min(scale, float(max_height) / height);
+    }
+    scaled_width = std::min(std::max(uint32_t(std::lround(width * scale)), 1u), std::max(max_width, 1u));
+    scaled_height = std::min(std::max(uint32_t(std::lround(height * scale)), 1u), std::max(max_height, 1u));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+
+// Picks the fraction of the view's size frames are drawn at so that they
+// keep to a target frame time. Frame times are averaged over kWindow frames,
+// then the scale moves by the square root of the ratio of target to average,
+// since the work per frame follows the pixel count. It drops quickly when
+// frames run long and recovers slowly, and frame times within kDeadband of
+// the target leave it alone so it does not hunt. Nothing here touches the
+// engine.
+class ResolutionController {
+public:
+    // Frames averaged per adjustment.
+    static const size_t kWindow = 8;
+
+    // 0 (the default) disables scaling, frames are drawn at maxScale().
+    void setTargetFrameTime(std::chrono::microseconds frame_time);
+    std::chrono::microseconds targetFrameTime() const { return mTarget; }
+
+    // Bounds of the scale, clamped to (0, 1]. 0.5 to 1 by default.
+    void setScaleRange(float min_scale, float max_scale);
+    float minScale() const { return mMinScale; }
+    float maxScale() const { return mMaxScale; }
+
+    float scale() const { return mScale; }
+
+    // Records the time a frame drawn at scale() took. Returns true if the
+    // scale changed.
+    bool frameTimed(std::chrono::microseconds frame_time);
+
+    // Pixels to draw for a view of width x height at scale, at least one,
+    // shrunk evenly to fit max_width x max_height.
+    static void extent(float scale, uint32_t width, uint32_t height,
+                       uint32_t max_width, uint32_t max_height,
+                       uint32_t &scaled_width, uint32_t &scaled_height);
+
+private:
+    static constexpr float kDeadband = 0.1f;
+    static constexpr float kMaxDecrease = 0.75f;
+    static constexpr float kMaxIncrease = 1.05f;
+
+    void restart();
+
+    std::chrono::microseconds mTarget{0};
+    float mMinScale = 0.5f;
+    float mMaxScale = 1.0f;
+    float mScale = 1.0f;
+    std::chrono::microseconds mWindowTime{0};
+    size_t mWindowFrames = 0;
+};
@@ -0,0 +1,406 @@
+#include "scene_cache.h"
+#include "compressed_cache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtDebug>
+
+#include <cstring>
+#include <memory>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const uint32_t kSceneCacheMagic = 0x43535451; // "QTSC"
+
+// Streams start on this boundary so that the mapped pointers are aligned.
+const size_t kStreamAlignment = 16;
+
+// Sequential writer that keeps track of the offset for alignment.
+class CacheWriter {
+public:
+    explicit CacheWriter(QIODevice &device) : mDevice(device) {}
+
+    bool ok() const { return mOk; }
+
+    void write(const void *data, size_t size) {
+        if (size == 0)
+            return;
+        if (mDevice.write(static_cast<const char*>(data), qint64(size)) != qint64(size))
+            mOk = false;
+        mOffset += size;
+    }
+
+    template <typename T>
+    void write(const T &value) { write(&value, sizeof(T)); }
+
+    void writeString(const std::string &str) {
+        write(uint32_t(str.size()));
+        write(str.data(), str.size());
+    }
+
+    template <typename T>
+    void writeStream(const std::vector<T> &stream) {
+        static const char zeros[kStreamAlignment] = {};
+        write(zeros, (kStreamAlignment - mOffset % kStreamAlignment) % kStreamAlignment);
+        write(stream.data(), stream.size() * sizeof(T));
+    }
+
+private:
+    QIODevice &mDevice;
+    size_t mOffset = 0;
+    bool mOk = true;
+};
+
+// Reader over the mapped file. Any read past the end fails the whole load.
+class CacheReader {
+public:
+    CacheReader(const uchar *data, size_t size) : mBase(data), mPos(data), mEnd(data + size) {}
+
+    bool ok() const { return mOk; }
+
+    template <typename T>
+    T read() {
+        T value{};
+        if (remaining() < sizeof(T)) {
+            mOk = false;
+            return value;
+        }
+        std::memcpy(&value, mPos, sizeof(T));
+        mPos += sizeof(T);
+        return value;
+    }
+
+    std::string readString() {
+        uint32_t size = read<uint32_t>();
+        if (!mOk || remaining() < size) {
+            mOk = false;
+            return std::string();
+        }
+        std::string str(reinterpret_cast<const char*>(mPos), size);
+        mPos += size;
+        return str;
+    }
+
+    template <typename T>
+    const T* readStream(size_t count) {
+        size_t pad = (kStreamAlignment - size_t(mPos - mBase) % kStreamAlignment) % kStreamAlignment;
+        if (!mOk || remaining() < pad || remaining() - pad < count * sizeof(T)) {
+            mOk = false;
+            return nullptr;
+        }
+        mPos += pad;
+        const T *stream = reinterpret_cast<const T*>(mPos);
+        mPos += count * sizeof(T);
+        return stream;
+    }
+
+private:
+    size_t remaining() const { return size_t(mEnd - mPos); }
+
+    const uchar *mBase;
+    const uchar *mPos;
+    const uchar *mEnd;
+    bool mOk = true;
+};
+
+void writeVec3(CacheWriter &out, const filament::math::float3 &v)
+{
+    out.write(v.x);
+    out.write(v.y);
+    out.write(v.z);
+}
+
+filament::math::float3 readVec3(CacheReader &in)
+{
+    float x = in.read<float>();
+    float y = in.read<float>();
+    float z = in.read<float>();
+    return { x, y, z };
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+QString defaultSceneCacheDir()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/scenes";
+}
+
+//------------------------------------------------------------------------------
+
+QString sceneCachePath(const QString &dir, const QByteArray &source_hash,
+                       unsigned import_flags, uint32_t mesh_options)
+{
+    return QString("%1/%2_%3_%4_v%5.qsc")
+        .arg(dir)
+        .arg(QString::fromLatin1(source_hash))
+        .arg(import_flags, 8, 16, QChar('0'))
+        .arg(mesh_options, 8, 16, QChar('0'))
+        .arg(kSceneCacheVersion);
+}
+
+//------------------------------------------------------------------------------
+
+QByteArray sceneSourceHash(const QString &dir, const QString &path)
+{
+    QFileInfo info(path);
+    if (!info.isFile())
+        return QByteArray();
+
+    // one stamp per source path: "<size> <mtime> <hash>".
+    const QByteArray path_hash =
+        QCryptographicHash::hash(info.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    const QString stamp_path = QString("%1/%2.stamp").arg(dir).arg(QString::fromLatin1(path_hash));
+    const QByteArray stamp = QByteArray::number(info.size()) + ' ' +
+        QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + ' ';
+
+    QFile in(stamp_path);
+    if (in.open(QIODevice::ReadOnly)) {
+        const QByteArray line = in.readAll();
+        if (line.size() > stamp.size() && line.startsWith(stamp))
+            return line.mid(stamp.size());
+    }
+
+    const QByteArray hash = hashFile(path);
+    if (hash.isEmpty())
+        return hash;
+    QDir().mkpath(dir);
+    QSaveFile out(stamp_path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(stamp + hash) != stamp.size() + hash.size() ||
+        !out.commit()) {
+        qInfo() << "Could not write scene cache stamp: " << stamp_path;
+    }
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+
+bool saveSceneCache(const QString &path, const SceneData &data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    CacheWriter out(file);
+    out.write(kSceneCacheMagic);
+    out.write(kSceneCacheVersion);
+    out.write(uint32_t(data.materials.size()));
+    out.write(uint32_t(data.meshes.size()));
+    out.write(uint32_t(data.meshParts.size()));
+    out.write(uint32_t(data.nodes.size()));
+
+    // albedo paths relative to the model, so a moved folder still hits.
+    for (const MaterialData &mat : data.materials) {
+        QDir basedir(QString::fromStdString(mat.basedir));
+        out.writeString(mat.albedoPath.empty() ? std::string() :
+                        basedir.relativeFilePath(QString::fromStdString(mat.albedoPath)).toStdString());
+    }
+
+    for (size_t i = 0; i < data.meshes.size(); ++i) {
+        const MeshData &mesh = data.meshes[i];
+        if (mesh.isMapped())
+            return false;
+        out.write(data.meshMaterials[i]);
+        out.write(uint32_t(mesh.format));
+        out.write(uint32_t(mesh.hasShortIndices() ? 1 : 0));
+        out.write(uint32_t(mesh.vertexCount()));
+        out.write(uint32_t(mesh.indexCount()));
+        writeVec3(out, mesh.aabb.center);
+        writeVec3(out, mesh.aabb.halfExtent);
+        writeVec3(out, mesh.quantOffset);
+        out.write(mesh.quantScale);
+        out.write(uint32_t(mesh.lods.size()));
+        for (const MeshData::Lod &lod : mesh.lods) {
+            out.write(lod.offset);
+            out.write(lod.count);
+            out.write(lod.error);
+        }
+        out.write(uint32_t(mesh.sources.size()));
+        for (const MeshData::BatchSource &source : mesh.sources) {
+            out.writeString(source.node);
+            out.write(source.mesh);
+            out.write(source.firstIndex);
+            out.write(source.indexCount);
+        }
+        if (mesh.format == VertexFormat::COMPACT) {
+            out.writeStream(mesh.compact);
+        } else {
+            out.writeStream(mesh.positions);
+            out.writeStream(mesh.uvs);
+            out.writeStream(mesh.tangents);
+        }
+        if (mesh.hasShortIndices())
+            out.writeStream(mesh.shortIndices);
+        else
+            out.writeStream(mesh.indices);
+    }
+
+    for (const std::vector<uint32_t> &parts : data.meshParts) {
+        out.write(uint32_t(parts.size()));
+        for (uint32_t part : parts) {
+            out.write(part);
+        }
+    }
+
+    for (const NodeData &node : data.nodes) {
+        out.writeString(node.name);
+        out.write(uint32_t(node.meshes.size()));
+        for (uint32_t mesh : node.meshes) {
+            out.write(mesh);
+        }
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                out.write(node.transform[i][j]);
+            }
+        }
+    }
+
+    return out.ok() && file.commit();
+}
+
+//------------------------------------------------------------------------------
+
+bool loadSceneCache(const QString &path, const std::string &filename, SceneData &data)
+{
+    data = SceneData();
+
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly) || file->size() == 0)
+        return false;
+
+    // the file has to stay open for the mapping to stay valid.
+    const uchar *base = file->map(0, file->size());
+    if (!base) {
+        qInfo() << "Could not map scene cache: " << path;
+        return false;
+    }
+    std::shared_ptr<const void> mapping = file;
+
+    CacheReader in(base, size_t(file->size()));
+    uint32_t magic = in.read<uint32_t>();
+    uint32_t version = in.read<uint32_t>();
+    uint32_t numMaterials = in.read<uint32_t>();
+    uint32_t numMeshes = in.read<uint32_t>();
+    uint32_t numSourceMeshes = in.read<uint32_t>();
+    uint32_t numNodes = in.read<uint32_t>();
+    if (!in.ok() || magic != kSceneCacheMagic || version != kSceneCacheVersion) {
+        qInfo() << "Ignoring invalid scene cache: " << path;
+        return false;
+    }
+
+    SceneData scene;
+    scene.filename = filename;
+
+    QFileInfo fileinfo(QString::fromStdString(filename));
+    QDir basedir = fileinfo.dir();
+    std::string basedir_str = basedir.canonicalPath().toStdString();
+    for (uint32_t i = 0; i < numMaterials && in.ok(); ++i) {
+        std::string albedo = in.readString();
+        scene.materials.push_back(materialData(
+            basedir_str,
+            albedo.empty() ? std::string() :
+                QDir::cleanPath(basedir.absoluteFilePath(QString::fromStdString(albedo))).toStdString()));
+    }
+
+    scene.meshes.resize(numMeshes);
+    scene.meshMaterials.resize(numMeshes);
+    for (uint32_t i = 0; i < numMeshes && in.ok(); ++i) {
+        MeshData &mesh = scene.meshes[i];
+        scene.meshMaterials[i] = in.read<uint32_t>();
+        uint32_t format = in.read<uint32_t>();
+        if (format != uint32_t(VertexFormat::FLOAT) && format != uint32_t(VertexFormat::COMPACT))
+            return false;
+        mesh.format = VertexFormat(format);
+        bool short_indices = in.read<uint32_t>() != 0;
+        size_t vertices = in.read<uint32_t>();
+        size_t indices = in.read<uint32_t>();
+        mesh.aabb.center = readVec3(in);
+        mesh.aabb.halfExtent = readVec3(in);
+        mesh.quantOffset = readVec3(in);
+        mesh.quantScale = in.read<float>();
+        uint32_t lods = in.read<uint32_t>();
+        for (uint32_t l = 0; l < lods && in.ok(); ++l) {
+            MeshData::Lod lod;
+            lod.offset = in.read<uint32_t>();
+            lod.count = in.read<uint32_t>();
+            lod.error = in.read<float>();
+            if (size_t(lod.offset) + lod.count > indices)
+                return false;
+            mesh.lods.push_back(lod);
+        }
+        uint32_t sources = in.read<uint32_t>();
+        for (uint32_t b = 0; b < sources && in.ok(); ++b) {
+            MeshData::BatchSource source;
+            source.node = in.readString();
+            source.mesh = in.read<uint32_t>();
+            source.firstIndex = in.read<uint32_t>();
+            source.indexCount = in.read<uint32_t>();
+            if (size_t(source.firstIndex) + source.indexCount > indices)
+                return false;
+            mesh.sources.push_back(std::move(source));
+        }
+        if (mesh.format == VertexFormat::COMPACT) {
+            mesh.mapped.compact = in.readStream<CompactVertex>(vertices);
+        } else {
+            mesh.mapped.positions = in.readStream<filament::math::float3>(vertices);
+            mesh.mapped.uvs = in.readStream<filament::math::float2>(vertices);
+            mesh.mapped.tangents = in.readStream<filament::math::float4>(vertices);
+        }
+        if (short_indices)
+            mesh.mapped.shortIndices = in.readStream<uint16_t>(indices);
+        else
+            mesh.mapped.indices = in.readStream<uint32_t>(indices);
+        mesh.mapped.vertexCount = vertices;
+        mesh.mapped.indexCount = indices;
+        mesh.mapped.file = mapping;
+        if (scene.meshMaterials[i] >= numMaterials && vertices > 0)
+            return false;
+    }
+
+    scene.meshParts.resize(numSourceMeshes);
+    for (uint32_t i = 0; i < numSourceMeshes && in.ok(); ++i) {
+        uint32_t count = in.read<uint32_t>();
+        for (uint32_t p = 0; p < count && in.ok(); ++p) {
+            uint32_t part = in.read<uint32_t>();
+            if (part >= numMeshes)
+                return false;
+            scene.meshParts[i].push_back(part);
+        }
+    }
+
+    for (uint32_t i = 0; i < numNodes && in.ok(); ++i) {
+        NodeData node;
+        node.name = in.readString();
+        uint32_t count = in.read<uint32_t>();
+        for (uint32_t m = 0; m < count && in.ok(); ++m) {
+            uint32_t mesh = in.read<uint32_t>();
+            if (mesh >= numSourceMeshes)
+                return false;
+            node.meshes.push_back(mesh);
+        }
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                node.transform[r][c] = in.read<float>();
+            }
+        }
+        scene.nodes.push_back(std::move(node));
+    }
+
+    if (!in.ok()) {
+        qInfo() << "Truncated scene cache: " << path;
+        return false;
+    }
+
+    data = std::move(scene);
+    return true;
+}
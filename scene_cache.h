@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include <QByteArray>
+#include <QString>
+
+#include "scene_data.h"
+
+//------------------------------------------------------------------------------
+
+// Binary cache of converted scenes, so that files opened before skip Assimp
+// and the mesh conversion entirely. A cache file holds the material bindings,
+// the flattened nodes and every mesh's staging streams exactly as they are
+// uploaded. Loading maps the file and points the meshes straight into it.
+//
+// Entries are named after a hash of the source file's contents, the import
+// flags, meshOptionsKey() and the format version, so a changed file or a
+// different setup never hits a stale entry.
+
+// Bumped whenever the layout or the conversion producing it changes.
+const uint32_t kSceneCacheVersion = 7;
+
+// Default cache directory under the platform's cache location.
+QString defaultSceneCacheDir();
+
+QString sceneCachePath(const QString &dir, const QByteArray &source_hash,
+                       unsigned import_flags, uint32_t mesh_options);
+
+// hashFile() of path, remembered in dir together with the file's size and
+// modification time, so an unchanged model is not read in full again just
+// to find its cache entry. Empty if the file cannot be read.
+QByteArray sceneSourceHash(const QString &dir, const QString &path);
+
+// Writes data's materials, nodes and meshes. Meshes must not be mapped.
+// Writes atomically, so concurrent loaders never see a partial file.
+bool saveSceneCache(const QString &path, const SceneData &data);
+
+// Maps path and fills data with the scene it holds, as if built from
+// filename. Textures are not decoded; see decodeSceneTextures(). Returns false
+// (leaving data empty) if the file is missing, truncated or of another
+// version.
+bool loadSceneCache(const QString &path, const std::string &filename, SceneData &data);
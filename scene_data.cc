@@ -0,0 +1,667 @@
+#include "scene_data.h"
+#include "compressed_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "texture_cache.h"
+#include "worker_pool.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+#include <QtDebug>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+//------------------------------------------------------------------------------
+
+static TextureSource textureSource(const QString &path, const QColor &fallback,
+                                   QImage::Format format,
+                                   filament::Texture::InternalFormat tex_format,
+                                   MipColorSpace color_space)
+{
+    TextureSource src;
+    src.path = path;
+    src.fallback = fallback;
+    src.format = format;
+    src.texFormat = tex_format;
+    src.colorSpace = color_space;
+    src.key = TextureCache::key(path, fallback, format, tex_format);
+    return src;
+}
+
+//------------------------------------------------------------------------------
+
+MaterialData materialData(const std::string &basedir, const std::string &albedo_path)
+{
+    using namespace filament;
+
+    MaterialData data;
+    data.basedir = basedir;
+    data.albedoPath = albedo_path;
+
+    QString dir = QString::fromStdString(basedir);
+    data.albedo = textureSource(QString::fromStdString(data.albedoPath),
+                                Qt::white,
+                                QImage::Format_RGBA8888,
+                                Texture::InternalFormat::SRGB8_A8,
+                                MipColorSpace::SRGB);
+
+    data.normalMap = textureSource(dir + "/Textures/normal.jpg",
+                                   QColor(127, 127, 255),
+                                   QImage::Format_RGB888,
+                                   Texture::InternalFormat::RGB8,
+                                   MipColorSpace::NORMAL);
+
+    data.aoMap = textureSource(dir + "/Textures/ao.jpg",
+                               Qt::white,
+                               QImage::Format_RGB888,
+                               Texture::InternalFormat::RGB8,
+                               MipColorSpace::LINEAR);
+
+    data.specMap = textureSource(dir + "/Textures/spec.jpg",
+                                 Qt::black,
+                                 QImage::Format_RGB888,
+                                 Texture::InternalFormat::RGB8,
+                                 MipColorSpace::LINEAR);
+
+    const QString mask_path = dir + "/Textures/mask.jpg";
+    data.masked = QFileInfo::exists(mask_path);
+    if (data.masked) {
+        data.maskMap = textureSource(mask_path,
+                                     Qt::white,
+                                     QImage::Format_RGB888,
+                                     Texture::InternalFormat::RGB8,
+                                     MipColorSpace::LINEAR);
+    }
+
+    return data;
+}
+
+//------------------------------------------------------------------------------
+
+static MaterialData extractMaterial(const aiMaterial *mat, const std::string &basedir)
+{
+    std::string albedo_path;
+    if (mat->GetTextureCount(aiTextureType_DIFFUSE)) {
+        aiString tex_path;
+        mat->GetTexture(aiTextureType_DIFFUSE, 0, &tex_path);
+
+        QString imgpathstr(tex_path.C_Str());
+        auto tokens = imgpathstr.split(QRegExp("\\\\|/"));
+        qInfo() << tokens;
+
+        albedo_path = basedir + "/Textures/" + tokens.last().toStdString();
+    }
+
+    return materialData(basedir, albedo_path);
+}
+
+//------------------------------------------------------------------------------
+
+static void flattenNodes(aiNode const *node, aiMatrix4x4 accTransform,
+                         std::vector<NodeData> &nodes)
+{
+    aiMatrix4x4 transform = accTransform * node->mTransformation;
+
+    if (node->mNumMeshes > 0) {
+        NodeData nd;
+        nd.name = node->mName.C_Str();
+        nd.meshes.assign(node->mMeshes, node->mMeshes + node->mNumMeshes);
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                // note that aiMatrix is row-major and mat4f is col-major
+                nd.transform[i][j] = transform[j][i];
+            }
+        }
+        nodes.push_back(std::move(nd));
+    }
+
+    for (unsigned i = 0; i < node->mNumChildren; ++i) {
+        flattenNodes(node->mChildren[i], transform, nodes);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Bounds of all of mesh's vertices, empty if it has none.
+static filament::Box meshBounds(const aiMesh *mesh)
+{
+    using namespace filament::math;
+
+    filament::Box box;
+    if (mesh->mNumVertices == 0)
+        return box;
+    const float3 *positions = reinterpret_cast<const float3*>(mesh->mVertices);
+    float3 lo = positions[0];
+    float3 hi = lo;
+    for (unsigned v = 1; v < mesh->mNumVertices; ++v) {
+        lo = min(lo, positions[v]);
+        hi = max(hi, positions[v]);
+    }
+    box.set(lo, hi);
+    return box;
+}
+
+//------------------------------------------------------------------------------
+
+// A mesh is only quantized in a frame shared with other meshes if that is at
+// most this many times its own size, which costs it up to two bits.
+static const float kMaxSharedFrameGrowth = 4.0f;
+
+// Quantization frames that let the meshes drawn by the same node share one
+// renderable, and so one transform: the bounds of all meshes connected to
+// each other through nodes. Meshes that would lose too much precision get an
+// empty frame and keep their own bounds.
+static std::vector<filament::Box> sharedFrames(const aiScene *scene,
+                                               const std::vector<NodeData> &nodes)
+{
+    using namespace filament::math;
+
+    const size_t numMeshes = scene->mNumMeshes;
+    std::vector<uint32_t> parent(numMeshes);
+    for (size_t m = 0; m < numMeshes; ++m) {
+        parent[m] = uint32_t(m);
+    }
+    auto find = [&](uint32_t m) {
+        while (parent[m] != m) {
+            parent[m] = parent[parent[m]];
+            m = parent[m];
+        }
+        return m;
+    };
+    for (const NodeData &node : nodes) {
+        for (size_t i = 1; i < node.meshes.size(); ++i) {
+            if (node.meshes[0] < numMeshes && node.meshes[i] < numMeshes)
+                parent[find(node.meshes[i])] = find(node.meshes[0]);
+        }
+    }
+
+    std::vector<filament::Box> bounds(numMeshes);
+    std::vector<filament::Box> groups(numMeshes);
+    std::vector<uint32_t> group_size(numMeshes, 0);
+    for (uint32_t m = 0; m < numMeshes; ++m) {
+        bounds[m] = meshBounds(scene->mMeshes[m]);
+        if (bounds[m].isEmpty())
+            continue;
+        filament::Box &group = groups[find(m)];
+        if (group.isEmpty())
+            group = bounds[m];
+        else
+            group.unionSelf(bounds[m]);
+        ++group_size[find(m)];
+    }
+
+    std::vector<filament::Box> frames(numMeshes);
+    for (uint32_t m = 0; m < numMeshes; ++m) {
+        const uint32_t root = find(m);
+        if (bounds[m].isEmpty() || group_size[root] < 2)
+            continue;
+        const float3 &own = bounds[m].halfExtent;
+        const float3 &shared = groups[root].halfExtent;
+        const float own_size = std::max({ own.x, own.y, own.z });
+        const float shared_size = std::max({ shared.x, shared.y, shared.z });
+        if (shared_size <= own_size * kMaxSharedFrameGrowth)
+            frames[m] = groups[root];
+    }
+    return frames;
+}
+
+//------------------------------------------------------------------------------
+
+// Meshes with at most kMaxBatchedMeshVertices vertices, drawn by at most
+// kMaxBatchedUses nodes, are merged into batches of up to kMaxBatchVertices.
+static const size_t kMaxBatchedMeshVertices = 4096;
+static const size_t kMaxBatchedUses = 3;
+static const size_t kMaxBatchVertices = 16384;
+
+// One node's use of a mesh that goes into a batch.
+struct BatchMember {
+    uint32_t node;
+    uint32_t mesh;
+    filament::math::float3 center; // of the mesh's bounds, in world space
+    size_t vertices;
+};
+
+// Splits members[begin, end) at the median of their centers until each
+// chunk fits kMaxBatchVertices. Chunks of a single member are not worth
+// a batch and are dropped.
+static void splitBatch(std::vector<BatchMember> &members, size_t begin, size_t end,
+                       std::vector<std::vector<BatchMember>> &batches)
+{
+    using namespace filament::math;
+
+    size_t vertices = 0;
+    float3 lo = members[begin].center;
+    float3 hi = lo;
+    for (size_t i = begin; i < end; ++i) {
+        vertices += members[i].vertices;
+        lo = min(lo, members[i].center);
+        hi = max(hi, members[i].center);
+    }
+    if (vertices <= kMaxBatchVertices) {
+        if (end - begin >= 2)
+            batches.emplace_back(members.begin() + begin, members.begin() + end);
+        return;
+    }
+
+    const float3 extent = hi - lo;
+    int axis = extent.x > extent.y ? 0 : 1;
+    if (extent.z > extent[axis])
+        axis = 2;
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(members.begin() + begin, members.begin() + mid, members.begin() + end,
+                     [&](const BatchMember &a, const BatchMember &b) {
+                         return a.center[axis] < b.center[axis];
+                     });
+    splitBatch(members, begin, mid, batches);
+    splitBatch(members, mid, end, batches);
+}
+
+// Groups the small meshes of scene by material and position into batches.
+static std::vector<std::vector<BatchMember>> planBatches(const aiScene *scene,
+                                                         const std::vector<NodeData> &nodes)
+{
+    using namespace filament::math;
+
+    std::vector<size_t> uses(scene->mNumMeshes, 0);
+    for (const NodeData &node : nodes) {
+        for (uint32_t m : node.meshes) {
+            if (m < uses.size())
+                ++uses[m];
+        }
+    }
+
+    std::vector<std::vector<BatchMember>> by_material(scene->mNumMaterials);
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (!isBakeableTransform(nodes[n].transform))
+            continue;
+        for (uint32_t m : nodes[n].meshes) {
+            if (m >= uses.size() || uses[m] > kMaxBatchedUses)
+                continue;
+            const aiMesh *mesh = scene->mMeshes[m];
+            if (mesh->mNumVertices == 0 || mesh->mNumVertices > kMaxBatchedMeshVertices ||
+                mesh->mNumFaces == 0 || mesh->mMaterialIndex >= by_material.size()) {
+                continue;
+            }
+
+            const float3 center = (nodes[n].transform * float4(meshBounds(mesh).center, 1.0f)).xyz;
+            by_material[mesh->mMaterialIndex].push_back(
+                { uint32_t(n), m, center, size_t(mesh->mNumVertices) });
+        }
+    }
+
+    std::vector<std::vector<BatchMember>> batches;
+    for (std::vector<BatchMember> &members : by_material) {
+        if (!members.empty())
+            splitBatch(members, 0, members.size(), batches);
+    }
+    return batches;
+}
+
+//------------------------------------------------------------------------------
+
+QImage decodeImage(const QString &path, QImage::Format format, const QColor &fallback)
+{
+    QImage img;
+    QFileInfo fileinfo(path);
+    if (!fileinfo.exists()) {
+        qInfo() << "File does not exist: " << path;
+    } else if (!img.load(path)) {
+        qInfo() << "Could not load image at: " << path;
+    }
+
+    // ensure correct format
+    img = img.convertToFormat(format);
+
+    if (img.isNull()){
+        // Create empty texture
+        qInfo() << "Creating default texture";
+        img = QImage(1, 1, format);
+        img.setPixelColor(0, 0, fallback);
+    }
+
+    return img;
+}
+
+//------------------------------------------------------------------------------
+
+// Normal maps lose too much to BC1, and the 1x1 fallbacks are not worth it.
+static bool shouldCompress(const TextureSource &src, const SceneBuildOptions &options)
+{
+    return options.compressTextures && src.colorSpace != MipColorSpace::NORMAL &&
+        QFileInfo::exists(src.path);
+}
+
+//------------------------------------------------------------------------------
+
+void decodeTexture(TextureSource &src, const SceneBuildOptions &options, MipTiming *timing)
+{
+    QString cache_path;
+    if (shouldCompress(src, options)) {
+        QByteArray hash = hashFile(src.path);
+        if (!hash.isEmpty()) {
+            cache_path = compressedCachePath(options.compressedCacheDir, hash,
+                                             BlockFormat::BC1, int(src.colorSpace));
+            CompressedTexture cached;
+            if (loadCompressedTexture(cache_path, cached)) {
+                src.compressed = std::make_shared<const CompressedTexture>(std::move(cached));
+                return;
+            }
+        }
+    }
+
+    src.image = decodeImage(src.path, src.format, src.fallback);
+    const int channels = src.image.format() == QImage::Format_RGBA8888 ? 4 : 3;
+    const auto mip_start = std::chrono::steady_clock::now();
+    src.mips = std::make_shared<const std::vector<MipLevel>>(
+        generateMipChain(src.image.constBits(),
+                         uint32_t(src.image.width()), uint32_t(src.image.height()),
+                         size_t(src.image.bytesPerLine()),
+                         channels,
+                         src.colorSpace));
+    if (timing) {
+        timing->time += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - mip_start);
+        timing->megapixels += src.image.width() * double(src.image.height()) / 1e6;
+    }
+
+    if (cache_path.isEmpty())
+        return;
+
+    // encode the whole chain and keep it for the next load.
+    CompressedTexture tex;
+    tex.width = uint32_t(src.image.width());
+    tex.height = uint32_t(src.image.height());
+    tex.levels.push_back(compressBlocks(src.image.constBits(), tex.width, tex.height,
+                                        size_t(src.image.bytesPerLine()), channels));
+    for (const MipLevel &mip : *src.mips) {
+        tex.levels.push_back(compressBlocks(mip.pixels.data(), mip.width, mip.height,
+                                            size_t(mip.width) * channels, channels));
+    }
+    if (!saveCompressedTexture(cache_path, tex))
+        qInfo() << "Could not write compressed texture cache: " << cache_path;
+
+    src.compressed = std::make_shared<const CompressedTexture>(std::move(tex));
+    src.image = QImage();
+    src.mips.reset();
+}
+
+//------------------------------------------------------------------------------
+
+// Decodes every distinct texture of data's materials and runs mesh_job for
+// each of num_meshes meshes, all on the pool in one go. The images are the
+// slowest jobs so they are handed out first.
+static bool decodeAndConvert(WorkerPool &pool, SceneData &data,
+                             const SceneBuildOptions &options,
+                             const ProgressCallback &progress,
+                             size_t num_meshes,
+                             const std::function<void(size_t)> &mesh_job)
+{
+    // Collect every distinct texture the materials reference. Each one is
+    // decoded once, however many materials share it.
+    std::vector<TextureSource*> sources;
+    std::unordered_map<std::string, size_t> unique;
+    std::vector<TextureSource*> images;
+    for (MaterialData &mat : data.materials) {
+        for (TextureSource *src : { &mat.albedo, &mat.normalMap, &mat.aoMap,
+                                    &mat.specMap, &mat.maskMap }) {
+            if (src->key.empty())
+                continue; // not used by this material
+            sources.push_back(src);
+            if (unique.emplace(src->key, images.size()).second)
+                images.push_back(src);
+        }
+    }
+
+    const size_t numImages = images.size();
+    const size_t numJobs = numImages + num_meshes;
+    std::atomic<size_t> finished{0};
+    std::atomic<bool> cancelled{false};
+    // per image, so the jobs need no lock to record them.
+    std::vector<MipTiming> mipTimes(numImages);
+    pool.parallelFor(numJobs, [&](size_t i) {
+        if (cancelled)
+            return;
+        if (i < numImages) {
+            decodeTexture(*images[i], options, &mipTimes[i]);
+        } else {
+            mesh_job(i - numImages);
+        }
+        size_t done = ++finished;
+        if (progress && !progress(float(done) / numJobs))
+            cancelled = true;
+    });
+
+    if (cancelled)
+        return false;
+
+    size_t uncompressed_bytes = 0;
+    size_t compressed_bytes = 0;
+    for (const TextureSource *src : images) {
+        if (src->compressed) {
+            // what the same chain would have taken uncompressed
+            const int channels = src->format == QImage::Format_RGBA8888 ? 4 : 3;
+            for (size_t level = 0; level < src->compressed->levels.size(); ++level) {
+                uncompressed_bytes += size_t(std::max(1u, src->compressed->width >> level)) *
+                    std::max(1u, src->compressed->height >> level) * channels;
+            }
+            compressed_bytes += src->compressed->byteSize();
+        }
+    }
+    if (compressed_bytes > 0) {
+        qInfo() << "Texture compression: " << uncompressed_bytes / 1e6 << " MB -> "
+                << compressed_bytes / 1e6 << " MB, saved "
+                << (uncompressed_bytes - compressed_bytes) / 1e6 << " MB";
+    }
+
+    // only the mip generator is timed, over the images it actually filtered;
+    // file decoding, format conversion and BC1 encoding are left out.
+    MipTiming mips;
+    size_t mipmapped = 0;
+    for (const MipTiming &timing : mipTimes) {
+        if (timing.megapixels > 0.0)
+            ++mipmapped;
+        mips.time += timing.time;
+        mips.megapixels += timing.megapixels;
+    }
+    if (mips.megapixels > 0.0) {
+        qInfo() << "Mipmapped " << mipmapped << " of " << images.size() << " textures, "
+                << mips.megapixels << " MP, " << (mips.time.count() / 1000.0) / mips.megapixels
+                << " ms/MP (summed over threads)";
+    }
+
+    // share the decoded images with every material that uses them.
+    for (TextureSource *src : sources) {
+        if (src->image.isNull() && !src->compressed) {
+            const TextureSource *decoded = images[unique[src->key]];
+            src->image = decoded->image;
+            src->mips = decoded->mips;
+            src->compressed = decoded->compressed;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t meshOptionsKey(const SceneBuildOptions &options)
+{
+    return uint32_t(options.vertexFormat) |
+        (options.splitLargeMeshes ? 1u << 8 : 0u) |
+        (options.optimizeMeshes ? 1u << 9 : 0u) |
+        (options.generateLods ? 1u << 10 : 0u) |
+        (options.batchStaticMeshes ? 1u << 11 : 0u);
+}
+
+//------------------------------------------------------------------------------
+
+bool decodeSceneTextures(WorkerPool &pool, SceneData &data,
+                         const SceneBuildOptions &options,
+                         const ProgressCallback &progress)
+{
+    return decodeAndConvert(pool, data, options, progress, 0, nullptr);
+}
+
+//------------------------------------------------------------------------------
+
+bool buildSceneData(const aiScene *scene, const std::string &filename,
+                    WorkerPool &pool, SceneData &data,
+                    const SceneBuildOptions &options,
+                    const ProgressCallback &progress)
+{
+    data = SceneData();
+    data.filename = filename;
+
+    if (!scene->mRootNode) {
+        qCritical() << "No root found in scene";
+        return false;
+    }
+
+    QFileInfo fileinfo(QString(filename.c_str()));
+    std::string basedir = fileinfo.dir().canonicalPath().toStdString();
+    qInfo() << "Basedir: " << basedir.c_str();
+
+    for (unsigned int i = 0; i < scene->mNumMaterials; ++i) {
+        data.materials.push_back(extractMaterial(scene->mMaterials[i], basedir));
+    }
+
+    flattenNodes(scene->mRootNode, aiMatrix4x4(), data.nodes);
+
+    const size_t numMeshes = scene->mNumMeshes;
+    std::vector<std::vector<BatchMember>> batches;
+    if (options.batchStaticMeshes)
+        batches = planBatches(scene, data.nodes);
+
+    // Take the batched meshes off their nodes. Meshes no node draws on its
+    // own any more need no conversion of their own.
+    std::vector<uint8_t> convert(numMeshes, 1);
+    if (!batches.empty()) {
+        std::vector<size_t> batched_uses(numMeshes, 0);
+        std::vector<size_t> uses(numMeshes, 0);
+        for (const NodeData &node : data.nodes) {
+            for (uint32_t m : node.meshes) {
+                if (m < numMeshes)
+                    ++uses[m];
+            }
+        }
+        size_t members = 0;
+        for (const std::vector<BatchMember> &batch : batches) {
+            for (const BatchMember &member : batch) {
+                std::vector<uint32_t> &meshes = data.nodes[member.node].meshes;
+                meshes.erase(std::find(meshes.begin(), meshes.end(), member.mesh));
+                ++batched_uses[member.mesh];
+            }
+            members += batch.size();
+        }
+        for (size_t m = 0; m < numMeshes; ++m) {
+            convert[m] = uses[m] == 0 || batched_uses[m] < uses[m];
+        }
+        qInfo() << "Static batching: " << members << " meshes into " << batches.size() << " batches";
+    }
+
+    const std::vector<filament::Box> frames = sharedFrames(scene, data.nodes);
+
+    // Every mesh has at least one part, empty meshes an empty one. Each batch
+    // becomes one more mesh after the scene's.
+    const size_t numJobs = numMeshes + batches.size();
+    std::vector<std::vector<MeshData>> parts(numJobs);
+    std::vector<VertexCacheStats> cacheBefore(numJobs);
+    std::vector<VertexCacheStats> cacheAfter(numJobs);
+    std::atomic<size_t> floatBytes{0};
+    std::atomic<size_t> wideIndexBytes{0};
+    bool ok = decodeAndConvert(pool, data, options, progress, numJobs, [&](size_t m) {
+        MeshData mesh;
+        if (m < numMeshes) {
+            if (!convert[m])
+                return;
+            convertMesh(scene->mMeshes[m], mesh);
+            if (options.optimizeMeshes)
+                optimizeMesh(mesh, &cacheBefore[m], &cacheAfter[m]);
+        } else {
+            // Members are optimized before they are merged, so that each one
+            // stays a contiguous range of the batch's indices.
+            for (const BatchMember &member : batches[m - numMeshes]) {
+                MeshData source;
+                if (!convertMesh(scene->mMeshes[member.mesh], source))
+                    continue;
+                if (options.optimizeMeshes) {
+                    VertexCacheStats before, after;
+                    optimizeMesh(source, &before, &after);
+                    cacheBefore[m] += before;
+                    cacheAfter[m] += after;
+                }
+                const NodeData &node = data.nodes[member.node];
+                appendMesh(mesh, source, node.transform, node.name, member.mesh);
+            }
+        }
+        floatBytes += mesh.vertexBytes();
+        wideIndexBytes += mesh.indexBytes();
+
+        // batches stay whole, their source ranges index the full mesh.
+        const filament::Box frame = m < numMeshes && !frames[m].isEmpty() ? frames[m] : mesh.aabb;
+        if (options.splitLargeMeshes && m < numMeshes)
+            parts[m] = splitMesh(std::move(mesh));
+        else
+            parts[m].push_back(std::move(mesh));
+
+        for (MeshData &part : parts[m]) {
+            if (options.generateLods)
+                generateLods(part);
+            if (options.vertexFormat == VertexFormat::COMPACT)
+                compactVertices(part, frame);
+            narrowIndices(part);
+        }
+    });
+    if (!ok)
+        return false;
+
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    data.meshParts.resize(numJobs);
+    for (size_t m = 0; m < numJobs; ++m) {
+        const unsigned material = m < numMeshes ? scene->mMeshes[m]->mMaterialIndex :
+            scene->mMeshes[batches[m - numMeshes][0].mesh]->mMaterialIndex;
+        for (MeshData &part : parts[m]) {
+            vertexBytes += part.vertexBytes();
+            indexBytes += part.indexBytes();
+            data.meshParts[m].push_back(uint32_t(data.meshes.size()));
+            data.meshMaterials.push_back(material);
+            data.meshes.push_back(std::move(part));
+        }
+    }
+
+    // batches are drawn in world space by nodes of their own.
+    for (size_t b = 0; b < batches.size(); ++b) {
+        NodeData node;
+        node.name = "batch " + std::to_string(b);
+        node.meshes.push_back(uint32_t(numMeshes + b));
+        data.nodes.push_back(std::move(node));
+    }
+    data.nodes.erase(std::remove_if(data.nodes.begin(), data.nodes.end(),
+                                    [](const NodeData &node) { return node.meshes.empty(); }),
+                     data.nodes.end());
+
+    if (options.optimizeMeshes) {
+        VertexCacheStats before, after;
+        for (size_t m = 0; m < numJobs; ++m) {
+            before += cacheBefore[m];
+            after += cacheAfter[m];
+        }
+        qInfo() << "Vertex cache (" << kVertexCacheSize << " entries): ACMR "
+                << before.acmr() << " -> " << after.acmr() << ", ATVR "
+                << before.atvr() << " -> " << after.atvr();
+    }
+    qInfo() << "Vertex data: " << vertexBytes / 1e6 << " MB, "
+            << floatBytes / 1e6 << " MB in the float layout";
+    qInfo() << "Index data: " << indexBytes / 1e6 << " MB, "
+            << wideIndexBytes / 1e6 << " MB with 32-bit indices, "
+            << data.meshes.size() << " parts from " << numMeshes << " meshes";
+
+    return true;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QColor>
+#include <QImage>
+#include <QString>
+
+#include <assimp/scene.h>
+
+#include <filament/Texture.h>
+#include <math/mat4.h>
+
+#include "block_compress.h"
+#include "mesh_data.h"
+#include "mipmap.h"
+
+class WorkerPool;
+
+//------------------------------------------------------------------------------
+
+// One texture a material needs: the file, the color to use if the file is
+// missing, and the formats to convert, filter and upload it with.
+struct TextureSource {
+    QString path;
+    QColor fallback;
+    QImage::Format format = QImage::Format_RGB888;
+    filament::Texture::InternalFormat texFormat = filament::Texture::InternalFormat::RGB8;
+    MipColorSpace colorSpace = MipColorSpace::LINEAR;
+    std::string key; // TextureCache key
+
+    // decoded ahead of the upload, null if not decoded yet
+    QImage image;
+    std::shared_ptr<const std::vector<MipLevel>> mips; // levels 1 and up
+
+    // block compressed image and mips, replaces image and mips when set
+    std::shared_ptr<const CompressedTexture> compressed;
+};
+
+// Texture bindings of one aiMaterial, resolved to files on disk.
+struct MaterialData {
+    std::string albedoPath;
+    std::string basedir;
+
+    TextureSource albedo;
+    TextureSource normalMap;
+    TextureSource aoMap;
+    TextureSource specMap;
+    TextureSource maskMap; // left empty unless masked
+
+    // A mask texture exists, so the material is drawn with alpha masking.
+    // Materials without one are drawn opaque, which keeps early depth
+    // rejection.
+    bool masked = false;
+};
+
+// A node of the aiScene hierarchy that references meshes, with its transform
+// already accumulated from the root.
+struct NodeData {
+    std::string name;
+    std::vector<uint32_t> meshes;
+    filament::math::mat4f transform;
+};
+
+// Everything the renderer needs from an imported file, without any reference
+// back to the aiScene. It is produced off the engine thread and consumed by
+// FilamentRenderer when the scene is uploaded.
+struct SceneData {
+    std::string filename;
+    std::vector<MaterialData> materials;
+    std::vector<MeshData> meshes;        // every part of every mesh
+    std::vector<uint32_t> meshMaterials; // material index of each part
+
+    // Indices into meshes of the parts each aiScene mesh was split into,
+    // indexed like aiScene::mMeshes and NodeData::meshes. Static batches
+    // follow the aiScene meshes.
+    std::vector<std::vector<uint32_t>> meshParts;
+
+    std::vector<NodeData> nodes;
+};
+
+// How buildSceneData() prepares a scene for a particular renderer.
+struct SceneBuildOptions {
+    // Block compress textures and keep the results in compressedCacheDir.
+    // Only set this if the engine supports the compressed formats.
+    bool compressTextures = false;
+    QString compressedCacheDir;
+
+    // Directory of the binary scene cache used by SceneLoader, empty to
+    // always import with Assimp.
+    QString sceneCacheDir;
+
+    // Vertex layout of the converted meshes.
+    VertexFormat vertexFormat = VertexFormat::COMPACT;
+
+    // Reorder triangles and vertices for the vertex cache, overdraw and
+    // vertex fetch, see mesh_optimizer.h.
+    bool optimizeMeshes = true;
+
+    // Build simplified LODs of large meshes, see mesh_simplify.h.
+    bool generateLods = true;
+
+    // Split meshes with more than kMaxShortIndexVertices vertices into parts
+    // that can all use 16-bit indices. Smaller meshes always do.
+    bool splitLargeMeshes = true;
+
+    // Merge small meshes that share a material into static batches with
+    // their node transforms baked in. Each batch covers a bounded region and
+    // vertex count so that it still culls well, and records its sources in
+    // MeshData::sources. Meshes drawn by many nodes are left to instancing.
+    bool batchStaticMeshes = false;
+};
+
+// Summarizes the options that change converted meshes, so that the scene
+// cache keeps results built with different options apart.
+uint32_t meshOptionsKey(const SceneBuildOptions &options);
+
+// Called with the fraction of the conversion done so far, possibly from worker
+// threads. Returning false cancels the conversion.
+using ProgressCallback = std::function<bool(float)>;
+
+// Loads path and converts it to format. Falls back to a 1x1 image of the
+// fallback color if the file is missing or cannot be decoded. Safe to call
+// from any thread.
+QImage decodeImage(const QString &path, QImage::Format format, const QColor &fallback);
+
+// Texture bindings of a material whose albedo is albedo_path (empty if it has
+// none); the other maps are looked up next to the model in basedir.
+MaterialData materialData(const std::string &basedir, const std::string &albedo_path);
+
+// Time spent in generateMipChain() and the size of the images it filtered.
+struct MipTiming {
+    std::chrono::microseconds time{0};
+    double megapixels = 0.0;
+};
+
+// Decodes src.image with decodeImage() and generates its mip chain. With
+// texture compression enabled the compressed chain is read from the disk
+// cache instead, or encoded and stored there. If timing is given, the mip
+// generation alone is added to it; cache hits add nothing.
+void decodeTexture(TextureSource &src,
+                   const SceneBuildOptions &options = SceneBuildOptions(),
+                   MipTiming *timing = nullptr);
+
+// Converts scene into data on the given pool, including decoding every
+// texture its materials reference. Returns false if the scene has no
+// root node or the conversion was cancelled.
+bool buildSceneData(const aiScene *scene, const std::string &filename,
+                    WorkerPool &pool, SceneData &data,
+                    const SceneBuildOptions &options = SceneBuildOptions(),
+                    const ProgressCallback &progress = ProgressCallback());
+
+// Decodes every texture data's materials reference, for scenes that were not
+// built by buildSceneData(). Returns false if cancelled.
+bool decodeSceneTextures(WorkerPool &pool, SceneData &data,
+                         const SceneBuildOptions &options = SceneBuildOptions(),
+                         const ProgressCallback &progress = ProgressCallback());
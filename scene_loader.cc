@@ -0,0 +1,188 @@
+#include "scene_loader.h"
+#include "scene_cache.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <assimp/postprocess.h>
+
+#include <QtDebug>
+
+#include <chrono>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Import takes the first half of the progress range, conversion the second.
+const float kImportShare = 0.5f;
+
+// Forwards Assimp's import progress and lets a cancellation abort the import.
+class ImportProgressHandler : public Assimp::ProgressHandler {
+public:
+    ImportProgressHandler(std::atomic<float> &progress, std::atomic<bool> &cancel)
+        : mProgress(progress), mCancel(cancel) {}
+
+    bool Update(float percentage) override {
+        if (percentage >= 0.0f)
+            mProgress = percentage * kImportShare;
+        return !mCancel;
+    }
+
+private:
+    std::atomic<float> &mProgress;
+    std::atomic<bool> &mCancel;
+};
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+SceneLoader::SceneLoader(unsigned num_threads) : mPool(num_threads) {}
+
+//------------------------------------------------------------------------------
+
+SceneLoader::~SceneLoader()
+{
+    cancel();
+    join();
+}
+
+//------------------------------------------------------------------------------
+
+unsigned SceneLoader::importFlags()
+{
+    return aiProcess_CalcTangentSpace       |
+           aiProcess_Triangulate            |
+           aiProcess_JoinIdenticalVertices  |
+           aiProcess_FixInfacingNormals     |
+           aiProcess_SortByPType;
+}
+
+//------------------------------------------------------------------------------
+
+void SceneLoader::load(const std::string &filename, const SceneBuildOptions &options)
+{
+    cancel();
+    join();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mResult.reset();
+    }
+    mCancel = false;
+    mProgress = 0.0f;
+    mState = State::LOADING;
+    mThread = std::thread(&SceneLoader::run, this, filename, options);
+}
+
+//------------------------------------------------------------------------------
+
+void SceneLoader::cancel()
+{
+    mCancel = true;
+}
+
+//------------------------------------------------------------------------------
+
+void SceneLoader::join()
+{
+    if (mThread.joinable())
+        mThread.join();
+}
+
+//------------------------------------------------------------------------------
+
+std::unique_ptr<SceneData> SceneLoader::takeScene()
+{
+    if (mState != State::READY)
+        return nullptr;
+
+    join();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mState = State::IDLE;
+    return std::move(mResult);
+}
+
+//------------------------------------------------------------------------------
+
+void SceneLoader::run(std::string filename, SceneBuildOptions options)
+{
+    // finding the entry is part of a cache hit, so it is timed too.
+    auto start = std::chrono::steady_clock::now();
+    QString cache_path;
+    if (!options.sceneCacheDir.isEmpty()) {
+        QByteArray hash = sceneSourceHash(options.sceneCacheDir, QString::fromStdString(filename));
+        if (!hash.isEmpty())
+            cache_path = sceneCachePath(options.sceneCacheDir, hash, importFlags(),
+                                        meshOptionsKey(options));
+    }
+    auto hash_micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::unique_ptr<SceneData> data(new SceneData());
+    bool ok = false;
+    if (!cache_path.isEmpty() && loadSceneCache(cache_path, filename, *data)) {
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        qInfo() << "Loaded " << filename.c_str() << " from the scene cache in "
+                << micros / 1000.0 << " ms, " << hash_micros / 1000.0 << " ms of it finding the entry";
+
+        // only the textures are left to do.
+        ok = decodeSceneTextures(mPool, *data, options, [this](float fraction) {
+            mProgress = fraction;
+            return !mCancel;
+        });
+    } else {
+        ok = import(filename, options, *data);
+        if (ok && !cache_path.isEmpty() && !saveSceneCache(cache_path, *data))
+            qInfo() << "Could not write scene cache: " << cache_path;
+    }
+
+    if (mCancel) {
+        qInfo() << "Cancelled loading " << filename.c_str();
+        mState = State::CANCELLED;
+        return;
+    }
+    if (!ok) {
+        mState = State::FAILED;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mResult = std::move(data);
+    }
+    mProgress = 1.0f;
+    mState = State::READY;
+}
+
+//------------------------------------------------------------------------------
+
+bool SceneLoader::import(const std::string &filename, const SceneBuildOptions &options,
+                         SceneData &data)
+{
+    using namespace Assimp;
+
+    Importer importer;
+    // the importer takes ownership of the handler.
+    importer.SetProgressHandler(new ImportProgressHandler(mProgress, mCancel));
+
+    const aiScene* scene = importer.ReadFile(filename, importFlags());
+
+    if (mCancel)
+        return false;
+
+    // If the import failed, report it
+    if (!scene) {
+        qInfo() << "Failed to load scene: " << importer.GetErrorString();
+        return false;
+    }
+    qInfo() << "Loaded scene successfully";
+
+    qInfo() << "Num meshes: " << scene->mNumMeshes;
+
+    return buildSceneData(scene, filename, mPool, data, options, [this](float fraction) {
+        mProgress = kImportShare + fraction * (1.0f - kImportShare);
+        return !mCancel;
+    });
+}
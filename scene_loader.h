@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "scene_data.h"
+#include "worker_pool.h"
+
+//------------------------------------------------------------------------------
+
+// Imports a file with Assimp and converts it into a SceneData on a background
+// thread, so the GUI thread never blocks on a load. Files found in the scene
+// cache skip Assimp and the conversion. The caller polls state()
+// and hands the finished scene to FilamentRenderer::setSceneData().
+class SceneLoader {
+public:
+    enum class State { IDLE, LOADING, READY, FAILED, CANCELLED };
+
+    explicit SceneLoader(unsigned num_threads = 0);
+    ~SceneLoader();
+
+    // Starts loading filename. A load that is still running is cancelled first.
+    void load(const std::string &filename,
+              const SceneBuildOptions &options = SceneBuildOptions());
+
+    // Requests cancellation of the running load. Returns immediately; state()
+    // becomes CANCELLED once the background thread has stopped.
+    void cancel();
+
+    State state() const { return mState; }
+
+    // Blocks until the running load, if any, has finished one way or another.
+    void wait() { join(); }
+
+    // Progress of the current load in [0, 1], covering import and conversion.
+    float progress() const { return mProgress; }
+
+    // Hands over the loaded scene once state() is READY and resets to IDLE.
+    std::unique_ptr<SceneData> takeScene();
+
+    // Assimp post-processing steps applied to every import.
+    static unsigned importFlags();
+
+private:
+    void run(std::string filename, SceneBuildOptions options);
+    bool import(const std::string &filename, const SceneBuildOptions &options,
+                SceneData &data);
+    void join();
+
+    WorkerPool mPool;
+    std::thread mThread;
+    std::atomic<State> mState{State::IDLE};
+    std::atomic<float> mProgress{0.0f};
+    std::atomic<bool> mCancel{false};
+
+    std::mutex mMutex;
+    std::unique_ptr<SceneData> mResult;
+};
@@ -0,0 +1,127 @@
+#include "target_ring.h"
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+
+TargetRing::TargetRing(size_t slots)
+    : mSize(std::min(std::max(slots, size_t(1)), kMaxSlots))
+{
+}
+
+//------------------------------------------------------------------------------
+
+bool TargetRing::transition(int slot, State from, State to)
+{
+    return mSlots[slot].state.compare_exchange_strong(from, to);
+}
+
+//------------------------------------------------------------------------------
+
+int TargetRing::acquireForWrite()
+{
+    int acquired = -1;
+    bool sampling = false;
+    for (size_t i = 0; i < mSize; ++i) {
+        if (acquired < 0 && transition(int(i), State::FREE, State::WRITING))
+            acquired = int(i);
+        else if (mSlots[i].state.load() == State::SAMPLING)
+            sampling = true;
+    }
+    if (acquired < 0) {
+        ++mStalls;
+        return -1;
+    }
+    if (sampling)
+        ++mOverlapped;
+    return acquired;
+}
+
+//------------------------------------------------------------------------------
+
+void TargetRing::abortWrite(int slot)
+{
+    transition(slot, State::WRITING, State::FREE);
+}
+
+//------------------------------------------------------------------------------
+
+void TargetRing::submitted(int slot, uint32_t width, uint32_t height)
+{
+    mSlots[slot].width.store(width);
+    mSlots[slot].height.store(height);
+    transition(slot, State::WRITING, State::PENDING);
+}
+
+//------------------------------------------------------------------------------
+
+void TargetRing::completed(int slot)
+{
+    // frames complete in submission order, so this is the newest one.
+    const uint64_t frame = mNextFrame++;
+    mSlots[slot].frame.store(frame);
+    if (!transition(slot, State::PENDING, State::READY))
+        return;
+    ++mRendered;
+
+    // whatever the GUI has not picked up yet is out of date now.
+    for (size_t i = 0; i < mSize; ++i) {
+        if (int(i) != slot && mSlots[i].frame.load() < frame &&
+            transition(int(i), State::READY, State::FREE)) {
+            ++mDropped;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int TargetRing::acquireLatest()
+{
+    // the renderer may free an older READY slot under us, which only makes
+    // the swap fail; try the remaining ones newest first.
+    for (;;) {
+        int newest = -1;
+        uint64_t newest_frame = mDisplayedFrame;
+        for (size_t i = 0; i < mSize; ++i) {
+            const uint64_t frame = mSlots[i].frame.load();
+            if (mSlots[i].state.load() == State::READY && frame > newest_frame) {
+                newest = int(i);
+                newest_frame = frame;
+            }
+        }
+        if (newest < 0)
+            return -1;
+        if (transition(newest, State::READY, State::SAMPLING)) {
+            mDisplayedFrame = newest_frame;
+            ++mDisplayed;
+            return newest;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TargetRing::retire(int slot)
+{
+    transition(slot, State::SAMPLING, State::RETIRING);
+}
+
+//------------------------------------------------------------------------------
+
+void TargetRing::release(int slot)
+{
+    transition(slot, State::RETIRING, State::FREE);
+}
+
+//------------------------------------------------------------------------------
+
+TargetRing::Stats TargetRing::stats() const
+{
+    Stats stats;
+    stats.rendered = mRendered;
+    stats.displayed = mDisplayed;
+    stats.dropped = mDropped;
+    stats.stalls = mStalls;
+    stats.overlapped = mOverlapped;
+    return stats;
+}
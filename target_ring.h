@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+
+// Hands render targets between the renderer, which draws into them, and the
+// GUI, which samples them, without either side waiting for the other. Each
+// slot moves through
+//
+//   FREE -> WRITING -> PENDING -> READY -> SAMPLING -> RETIRING -> FREE
+//
+// The renderer takes a FREE slot, draws, and marks it PENDING until the
+// fence behind its commands signals; then it is READY. The GUI picks the
+// newest READY slot and samples it until a newer one is ready, then retires
+// it until its own fence shows the GPU is done reading. READY slots that
+// are overtaken by a newer frame before the GUI gets to them go straight
+// back to FREE. All transitions are atomic compare-and-swaps, so the two
+// sides never lock or block each other; the fences are polled, never waited
+// on. Nothing here touches GL or the engine.
+class TargetRing {
+public:
+    static const size_t kMaxSlots = 3;
+
+    enum class State : uint32_t { FREE, WRITING, PENDING, READY, SAMPLING, RETIRING };
+
+    struct Stats {
+        uint64_t rendered = 0;   // frames whose fence signaled
+        uint64_t displayed = 0;  // frames the GUI picked up
+        uint64_t dropped = 0;    // completed, but overtaken before display
+        uint64_t stalls = 0;     // frames not drawn because no slot was free
+        uint64_t overlapped = 0; // frames drawn while the GUI sampled another
+    };
+
+    explicit TargetRing(size_t slots = kMaxSlots);
+
+    size_t size() const { return mSize; }
+    State state(size_t slot) const { return mSlots[slot].state.load(); }
+
+    // Renderer side.
+
+    // A FREE slot now WRITING, or -1 if there is none.
+    int acquireForWrite();
+    // Gives a slot that was not drawn after all back.
+    void abortWrite(int slot);
+    // The frame's commands are submitted, a fence has to signal next. The
+    // frame covers width x height pixels from the target's origin.
+    void submitted(int slot, uint32_t width, uint32_t height);
+    // The fence signaled: the slot is READY and older READY ones are FREE.
+    void completed(int slot);
+
+    // GUI side.
+
+    // The newest READY slot, now SAMPLING, if it is newer than what the GUI
+    // samples now; -1 otherwise.
+    int acquireLatest();
+    // The GUI moved on from a SAMPLING slot, its reads may still be in flight.
+    void retire(int slot);
+    // The GUI's fence for a RETIRING slot signaled.
+    void release(int slot);
+
+    // Pixels the frame in a slot covers, valid from READY on.
+    uint32_t width(int slot) const { return mSlots[slot].width.load(); }
+    uint32_t height(int slot) const { return mSlots[slot].height.load(); }
+
+    Stats stats() const;
+
+private:
+    struct Slot {
+        std::atomic<State> state{State::FREE};
+        std::atomic<uint64_t> frame{0}; // valid while READY or later
+        std::atomic<uint32_t> width{0};
+        std::atomic<uint32_t> height{0};
+    };
+
+    bool transition(int slot, State from, State to);
+
+    Slot mSlots[kMaxSlots];
+    size_t mSize;
+    std::atomic<uint64_t> mNextFrame{1};
+    uint64_t mDisplayedFrame = 0; // GUI side
+
+    std::atomic<uint64_t> mRendered{0};
+    std::atomic<uint64_t> mDisplayed{0};
+    std::atomic<uint64_t> mDropped{0};
+    std::atomic<uint64_t> mStalls{0};
+    std::atomic<uint64_t> mOverlapped{0};
+};
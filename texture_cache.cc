@@ -0,0 +1,125 @@
+#include "texture_cache.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+
+//------------------------------------------------------------------------------
+
+std::string TextureCache::fileKey(const QString &path, QImage::Format format,
+                                  filament::Texture::InternalFormat tex_format)
+{
+    QFileInfo fileinfo(path);
+    QString canonical = fileinfo.canonicalFilePath();
+    if (canonical.isEmpty())
+        canonical = fileinfo.absoluteFilePath();
+
+    return QString("file:%1|%2|%3|%4")
+        .arg(canonical)
+        .arg(int(format))
+        .arg(int(tex_format))
+        .arg(fileinfo.lastModified().toMSecsSinceEpoch())
+        .toStdString();
+}
+
+//------------------------------------------------------------------------------
+
+std::string TextureCache::colorKey(const QColor &color, QImage::Format format,
+                                   filament::Texture::InternalFormat tex_format)
+{
+    return QString("color:%1|%2|%3")
+        .arg(color.rgba(), 8, 16, QChar('0'))
+        .arg(int(format))
+        .arg(int(tex_format))
+        .toStdString();
+}
+
+//------------------------------------------------------------------------------
+
+std::string TextureCache::key(const QString &path, const QColor &fallback,
+                              QImage::Format format,
+                              filament::Texture::InternalFormat tex_format)
+{
+    // Missing files all share the fallback texture of their default color.
+    if (QFileInfo::exists(path))
+        return fileKey(path, format, tex_format);
+    return colorKey(fallback, format, tex_format);
+}
+
+//------------------------------------------------------------------------------
+
+filament::Texture* TextureCache::acquire(const std::string &key)
+{
+    auto it = mEntries.find(key);
+    if (it == mEntries.end()) {
+        ++mMisses;
+        return nullptr;
+    }
+
+    ++mHits;
+    ++it->second.refs;
+    return it->second.texture;
+}
+
+//------------------------------------------------------------------------------
+
+void TextureCache::insert(const std::string &key, const Entry &entry)
+{
+    Entry &e = mEntries[key];
+    e = entry;
+    e.refs = 1;
+    mKeys[entry.texture] = key;
+}
+
+//------------------------------------------------------------------------------
+
+bool TextureCache::release(filament::Texture *tex, Entry &out)
+{
+    auto key = mKeys.find(tex);
+    if (key == mKeys.end())
+        return false;
+
+    auto it = mEntries.find(key->second);
+    if (--it->second.refs > 0)
+        return false;
+
+    out = it->second;
+    mEntries.erase(it);
+    mKeys.erase(key);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+filament::Texture* TextureCache::placeholder(filament::Texture *tex) const
+{
+    auto key = mKeys.find(tex);
+    if (key == mKeys.end())
+        return nullptr;
+    return mEntries.at(key->second).placeholder;
+}
+
+//------------------------------------------------------------------------------
+
+filament::Texture* TextureCache::uploaded(filament::Texture *tex)
+{
+    auto key = mKeys.find(tex);
+    if (key == mKeys.end())
+        return nullptr;
+
+    Entry &e = mEntries[key->second];
+    filament::Texture *placeholder = e.placeholder;
+    e.placeholder = nullptr;
+    e.uploadTag = 0;
+    return placeholder;
+}
+
+//------------------------------------------------------------------------------
+
+TextureCache::Stats TextureCache::stats() const
+{
+    Stats s;
+    s.hits = mHits;
+    s.misses = mMisses;
+    s.entries = mEntries.size();
+    return s;
+}
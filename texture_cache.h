@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <QColor>
+#include <QImage>
+#include <QString>
+
+#include <filament/Texture.h>
+
+//------------------------------------------------------------------------------
+
+// Reference counted textures shared between materials and scenes. Textures are
+// keyed by their canonical file path, the requested formats and the file's
+// modification time, so a map referenced by many materials is decoded and
+// uploaded once. The 1x1 fallback textures are keyed by color and format.
+//
+// The cache only does the bookkeeping; creating and destroying the engine
+// objects is left to the renderer.
+class TextureCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t entries = 0;
+    };
+
+    // A cached texture. While the full image is still queued for upload the
+    // placeholder is bound in its place; uploadTag identifies that upload.
+    struct Entry {
+        filament::Texture *texture = nullptr;
+        filament::Texture *placeholder = nullptr;
+        uint32_t uploadTag = 0;
+        uint32_t refs = 0;
+    };
+
+    static std::string fileKey(const QString &path, QImage::Format format,
+                               filament::Texture::InternalFormat tex_format);
+    static std::string colorKey(const QColor &color, QImage::Format format,
+                                filament::Texture::InternalFormat tex_format);
+
+    // fileKey() if path exists, otherwise the colorKey() of its fallback.
+    static std::string key(const QString &path, const QColor &fallback,
+                           QImage::Format format,
+                           filament::Texture::InternalFormat tex_format);
+
+    // Returns the cached texture for key and adds a reference to it, or
+    // nullptr if there is none.
+    filament::Texture* acquire(const std::string &key);
+
+    // Adds a texture created for key with a single reference.
+    void insert(const std::string &key, const Entry &entry);
+
+    // Drops a reference. Returns true and fills out when this was the last one;
+    // the caller then destroys the engine objects.
+    bool release(filament::Texture *tex, Entry &out);
+
+    // Placeholder bound in place of tex, or nullptr if tex is fully uploaded.
+    filament::Texture* placeholder(filament::Texture *tex) const;
+
+    // Marks tex as uploaded and returns its placeholder for destruction.
+    filament::Texture* uploaded(filament::Texture *tex);
+
+    Stats stats() const;
+    void resetStats() { mHits = mMisses = 0; }
+
+private:
+    std::unordered_map<std::string, Entry> mEntries;
+    std::unordered_map<filament::Texture*, std::string> mKeys;
+    size_t mHits = 0;
+    size_t mMisses = 0;
+};
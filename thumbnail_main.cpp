@@ -0,0 +1,229 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSet>
+#include <QTextStream>
+#include <QtDebug>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <filament/Engine.h>
+
+#include "filament_renderer.h"
+#include "scene_loader.h"
+
+//------------------------------------------------------------------------------
+
+// Renders a thumbnail of every model given on the command line or listed in
+// a file, without a window or a GUI. Each model is framed the way the viewer
+// frames a new scene. The next model is imported on the loader's threads
+// while the current one is uploaded and drawn, so at steady state a model
+// costs the larger of the two rather than their sum.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+bool parseBackend(const QString &name, filament::Engine::Backend &backend)
+{
+    if (name == "opengl")
+        backend = filament::Engine::Backend::OPENGL;
+    else if (name == "vulkan")
+        backend = filament::Engine::Backend::VULKAN;
+    else if (name == "noop")
+        backend = filament::Engine::Backend::NOOP;
+    else
+        return false;
+    return true;
+}
+
+bool parseVertexFormat(const QString &name, VertexFormat &format)
+{
+    if (name == "compact")
+        format = VertexFormat::COMPACT;
+    else if (name == "float")
+        format = VertexFormat::FLOAT;
+    else
+        return false;
+    return true;
+}
+
+size_t vertexBytes(const SceneData &data)
+{
+    size_t bytes = 0;
+    for (const MeshData &mesh : data.meshes) {
+        bytes += mesh.vertexBytes();
+    }
+    return bytes;
+}
+
+// One line per file, empty lines and lines starting with # are skipped.
+bool readFileList(const QString &path, std::vector<std::string> &files)
+{
+    QFile list(path);
+    if (!list.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream in(&list);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (!line.isEmpty() && !line.startsWith('#'))
+            files.push_back(line.toStdString());
+    }
+    return true;
+}
+
+// Named after the model, numbered if another model had the same name.
+QString thumbnailPath(const QDir &dir, const std::string &file, QSet<QString> &used)
+{
+    const QString base = QFileInfo(QString::fromStdString(file)).completeBaseName();
+    QString name = base;
+    for (int n = 2; used.contains(name); ++n)
+        name = QString("%1_%2").arg(base).arg(n);
+    used.insert(name);
+    return dir.filePath(name + ".png");
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders model thumbnails without a window.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "Models to render.", "[files...]");
+    QCommandLineOption list_option({ "l", "list" }, "Also render the models listed in <file>, one per line.", "file");
+    QCommandLineOption output_option({ "o", "output" }, "Write thumbnails to <dir>.", "dir", ".");
+    QCommandLineOption size_option({ "s", "size" }, "Thumbnail width and height in pixels.", "pixels", "256");
+    QCommandLineOption backend_option({ "b", "backend" },
+                                      "Engine backend: opengl, vulkan or noop. Without a GPU, opengl and "
+                                      "vulkan run on Mesa's llvmpipe and lavapipe. On Linux opengl still "
+                                      "needs an X display, e.g. under xvfb-run, unless Filament was built "
+                                      "for headless EGL. noop skips the GPU work and writes no images.",
+                                      "backend", "opengl");
+    QCommandLineOption vertex_format_option("vertex-format",
+                                            "Vertex layout to upload: compact or float. Compare the "
+                                            "upload times of the two on the same models.",
+                                            "layout", "compact");
+    parser.addOption(list_option);
+    parser.addOption(output_option);
+    parser.addOption(size_option);
+    parser.addOption(backend_option);
+    parser.addOption(vertex_format_option);
+    parser.process(app);
+
+    std::vector<std::string> files;
+    for (const QString &file : parser.positionalArguments()) {
+        files.push_back(file.toStdString());
+    }
+    if (parser.isSet(list_option) && !readFileList(parser.value(list_option), files)) {
+        qCritical() << "Could not read file list " << parser.value(list_option);
+        return 1;
+    }
+    if (files.empty())
+        parser.showHelp(1);
+
+    filament::Engine::Backend backend;
+    if (!parseBackend(parser.value(backend_option), backend)) {
+        qCritical() << "Unknown backend " << parser.value(backend_option);
+        return 1;
+    }
+    VertexFormat vertex_format;
+    if (!parseVertexFormat(parser.value(vertex_format_option), vertex_format)) {
+        qCritical() << "Unknown vertex format " << parser.value(vertex_format_option);
+        return 1;
+    }
+    bool size_ok = false;
+    const int size = parser.value(size_option).toInt(&size_ok);
+    if (!size_ok || size <= 0) {
+        qCritical() << "Invalid size " << parser.value(size_option);
+        return 1;
+    }
+    QDir output_dir(parser.value(output_option));
+    if (!output_dir.mkpath(".")) {
+        qCritical() << "Could not create " << output_dir.path();
+        return 1;
+    }
+
+    std::unique_ptr<FilamentRenderer> renderer(new FilamentRenderer());
+    if (!renderer->initHeadless(backend, uint32_t(size), uint32_t(size))) {
+        qCritical() << "Could not start the " << parser.value(backend_option)
+                    << " backend without a window; try xvfb-run or another --backend";
+        return 1;
+    }
+    renderer->setVertexFormat(vertex_format);
+    const SceneBuildOptions options = renderer->sceneBuildOptions();
+    const bool read_back = backend != filament::Engine::Backend::NOOP;
+
+    size_t rendered = 0;
+    size_t failed = 0;
+    size_t vertex_bytes = 0;
+    Clock::duration load_wait{0}, upload_time{0}, render_time{0};
+    QSet<QString> used_names;
+
+    SceneLoader loader;
+    const auto start = Clock::now();
+    loader.load(files.front(), options);
+    for (size_t i = 0; i < files.size(); ++i) {
+        const auto wait_start = Clock::now();
+        loader.wait();
+        load_wait += Clock::now() - wait_start;
+
+        std::unique_ptr<SceneData> data;
+        if (loader.state() == SceneLoader::State::READY)
+            data = loader.takeScene();
+
+        // import the next model while this one is uploaded and drawn.
+        if (i + 1 < files.size())
+            loader.load(files[i + 1], options);
+
+        if (!data) {
+            qCritical() << "Failed to load " << files[i].c_str();
+            ++failed;
+            continue;
+        }
+
+        vertex_bytes += vertexBytes(*data);
+        const auto upload_start = Clock::now();
+        renderer->setSceneDataNow(std::move(data));
+        const auto render_start = Clock::now();
+        upload_time += render_start - upload_start;
+
+        QImage image;
+        const bool drawn = renderer->renderImage(image);
+        render_time += Clock::now() - render_start;
+        if (read_back) {
+            const QString path = thumbnailPath(output_dir, files[i], used_names);
+            if (!drawn || !image.save(path)) {
+                qCritical() << "Failed to write " << path;
+                ++failed;
+                continue;
+            }
+        }
+        ++rendered;
+    }
+    const double total = seconds(Clock::now() - start);
+
+    std::printf("%zu models rendered, %zu failed in %.2f s: %.2f models/s\n",
+                rendered, failed, total, total > 0.0 ? rendered / total : 0.0);
+    std::printf("waiting on imports %.2f s, uploading %.2f s, drawing %.2f s\n",
+                seconds(load_wait), seconds(upload_time), seconds(render_time));
+    std::printf("uploaded %.1f MB of vertices in the %s layout\n", vertex_bytes / 1e6,
+                vertex_format == VertexFormat::COMPACT ? "compact" : "float");
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#include "upload_scheduler.h"
+
+#include <algorithm>
+#include <limits>
+
+//------------------------------------------------------------------------------
+
+void UploadScheduler::enqueue(uint32_t tag, size_t bytes, Upload upload)
+{
+    mQueue.push_back({tag, bytes, std::move(upload)});
+    mPendingBytes += bytes;
+}
+
+//------------------------------------------------------------------------------
+
+size_t UploadScheduler::drain(size_t byte_budget, std::chrono::microseconds time_budget)
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    size_t bytes = 0;
+    size_t count = 0;
+    while (!mQueue.empty()) {
+        const Entry &next = mQueue.front();
+        if (count > 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+            if (bytes + next.bytes > byte_budget || elapsed >= time_budget)
+                break;
+        }
+
+        // pop before running, the upload may enqueue or cancel other work.
+        Entry entry = std::move(mQueue.front());
+        mQueue.pop_front();
+        mPendingBytes -= entry.bytes;
+
+        entry.upload();
+        bytes += entry.bytes;
+        ++count;
+    }
+
+    mStats.lastBytes = bytes;
+    mStats.lastCount = count;
+    mStats.lastTime = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+    mStats.totalBytes += bytes;
+    return bytes;
+}
+
+//------------------------------------------------------------------------------
+
+void UploadScheduler::flush()
+{
+    drain(std::numeric_limits<size_t>::max(), std::chrono::microseconds::max());
+}
+
+//------------------------------------------------------------------------------
+
+void UploadScheduler::cancel(uint32_t tag)
+{
+    auto it = std::remove_if(mQueue.begin(), mQueue.end(),
+                             [tag](const Entry &e) { return e.tag == tag; });
+    mQueue.erase(it, mQueue.end());
+
+    mPendingBytes = 0;
+    for (const Entry &e : mQueue) {
+        mPendingBytes += e.bytes;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+size_t UploadScheduler::pendingCount(uint32_t tag) const
+{
+    return size_t(std::count_if(mQueue.begin(), mQueue.end(),
+                                [tag](const Entry &e) { return e.tag == tag; }));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+//------------------------------------------------------------------------------
+
+// Queues buffer and image uploads so they can be spread over several frames.
+// Each upload is a closure that submits the data to the engine (setBufferAt,
+// setBuffer, setImage, ...) together with its size in bytes. Every draw()
+// drains the queue in FIFO order against a byte and a time budget.
+//
+// Uploads are tagged with the generation of the scene they belong to, so all
+// uploads of a scene can be dropped before its engine objects are destroyed.
+class UploadScheduler {
+public:
+    using Upload = std::function<void()>;
+
+    struct Stats {
+        size_t lastBytes = 0;                      // submitted by the last drain()
+        size_t lastCount = 0;
+        std::chrono::microseconds lastTime{0};
+        size_t totalBytes = 0;                     // submitted since creation
+    };
+
+    void enqueue(uint32_t tag, size_t bytes, Upload upload);
+
+    // Runs queued uploads until the next one would exceed byte_budget or the
+    // time budget is used up. At least one upload runs per call so that an
+    // upload larger than the budget still goes through. Returns the number of
+    // bytes submitted.
+    size_t drain(size_t byte_budget, std::chrono::microseconds time_budget);
+
+    // Runs everything that is queued.
+    void flush();
+
+    // Drops all queued uploads with the given tag without running them.
+    void cancel(uint32_t tag);
+
+    bool empty() const { return mQueue.empty(); }
+    size_t pendingBytes() const { return mPendingBytes; }
+    size_t pendingCount(uint32_t tag) const;
+
+    const Stats &stats() const { return mStats; }
+
+private:
+    struct Entry {
+        uint32_t tag;
+        size_t bytes;
+        Upload upload;
+    };
+
+    std::deque<Entry> mQueue;
+    size_t mPendingBytes = 0;
+    Stats mStats;
+};
@@ -0,0 +1,115 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+//------------------------------------------------------------------------------
+
+WorkerPool::WorkerPool(unsigned numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the calling thread always participates, so spawn one less.
+    for (unsigned i = 1; i < numThreads; ++i) {
+        mWorkers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+//------------------------------------------------------------------------------
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    for (std::thread &t : mWorkers) {
+        t.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void WorkerPool::workerLoop()
+{
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+            if (mJobs.empty())
+                return;
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+        job();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void WorkerPool::enqueue(std::function<void()> job)
+{
+    if (mWorkers.empty()) {
+        job();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(std::move(job));
+    }
+    mCondition.notify_one();
+}
+
+//------------------------------------------------------------------------------
+
+void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)> &fn)
+{
+    if (count == 0)
+        return;
+
+    if (mWorkers.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    // Shared between the helpers and the caller. Helpers may still be queued
+    // after the caller has drained all indices, so the state is ref-counted.
+    struct State {
+        std::atomic<size_t> next{0};
+        size_t count = 0;
+        size_t pending = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+    state->count = count;
+
+    auto drain = [state, &fn]() {
+        for (size_t i = state->next++; i < state->count; i = state->next++) {
+            fn(i);
+        }
+    };
+
+    const size_t helpers = std::min(mWorkers.size(), count - 1);
+    state->pending = helpers;
+    for (size_t h = 0; h < helpers; ++h) {
+        enqueue([state, drain]() {
+            drain();
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (--state->pending == 0)
+                state->done.notify_one();
+        });
+    }
+
+    drain();
+
+    // fn is captured by reference, so wait for every helper to finish.
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state]() { return state->pending == 0; });
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// A small fixed-size pool of worker threads used to spread CPU-side scene
+// processing (mesh conversion, image decoding, ...) over all cores. Engine
+// calls must never be made from inside a job; the pool only produces staging
+// data that the engine thread consumes afterwards.
+class WorkerPool {
+public:
+    // numThreads == 0 picks std::thread::hardware_concurrency(). With a single
+    // thread all work runs inline on the calling thread.
+    explicit WorkerPool(unsigned numThreads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Total number of threads working on a parallelFor, including the caller.
+    unsigned numThreads() const { return unsigned(mWorkers.size()) + 1; }
+
+    // Calls fn(i) for every i in [0, count) and blocks until all calls have
+    // returned. The calling thread takes part in the work. Indices are handed
+    // out dynamically so uneven job sizes still balance across threads.
+    void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+    // Queues a job that runs on one of the workers without waiting for it.
+    // With a single-threaded pool the job runs inline.
+    void enqueue(std::function<void()> job);
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mJobs;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopping = false;
+};